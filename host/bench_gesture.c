@@ -0,0 +1,129 @@
+/*
+ * Times gesture_step frame by frame over a trace, then over a made up
+ * worst case: every finger landing on one frame and the held taps, full,
+ * flushed on the next.  Each frame is run BENCH_RUNS times from the same
+ * state, and the least of BENCH_TRIES such means is taken, so a frame
+ * the scheduler interrupted is not counted against it.
+ * Fails when the slowest frame is over GESTURE_BUDGET_CYCLES at 240 MHz,
+ * taking this machine to be HOST_SPEEDUP times faster, so it catches a
+ * frame whose cost grows with history rather than a few cycles over.
+ *
+ *	bench_gesture [-b base] < trace
+ */
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "detect.h"
+#include "gesture.h"
+
+#define ROWS                        32
+#define BENCH_RUNS                 200
+#define BENCH_TRIES                  5
+#define BENCH_FRAMES              2000	// of the made up stream
+#define CPU_MHZ                    240
+#define HOST_SPEEDUP                 4
+
+static Gestures gestures;
+static uint32_t frame_us;
+
+static uint64_t ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static void emit(int idx, int ch)
+{
+}
+
+static void finger(int idx, int ch)
+{
+	gesture_tap(&gestures, idx, ch, frame_us);
+}
+
+// ns of one gesture_step from the state as it stands, which it then takes one step
+static uint64_t step(Matcher *m, const uint16_t *level, uint32_t us)
+{
+	Gestures g = gestures;
+	Matcher saved[GESTURE_TEMPLATES];
+	uint64_t t, best = UINT64_MAX;
+	int i, try;
+
+	memcpy(saved, m, sizeof(saved));
+	for (try = 0; try < BENCH_TRIES; try++) {
+		t = ns();
+		for (i = 0; i < BENCH_RUNS; i++) {
+			gestures = g;
+			memcpy(m, saved, sizeof(saved));
+			gesture_step(&gestures, level, us);
+		}
+		if ((t = (ns() - t) / BENCH_RUNS) < best) {
+			best = t;
+		}
+	}
+	return best;
+}
+
+int main(int argc, char *argv[])
+{
+	char line[256];
+	uint16_t items[DETECT_CHANNELS];
+	uint64_t t, trace_max = 0, worst_max = 0, budget;
+	uint32_t us, frames = 0;
+	int base = 24, opt, i, f;
+	Detect detect;
+	Matcher matchers[GESTURE_TEMPLATES];
+
+	while ((opt = getopt(argc, argv, "b:")) != -1) {
+		switch (opt) {
+		case 'b':
+			base = atoi(optarg);
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-b base] < trace\n", argv[0]);
+			return 1;
+		}
+	}
+
+	detect_init(&detect, base, ROWS);
+	gesture_init(&gestures, gesture_templates, matchers, GESTURE_TEMPLATES, emit);
+	while (fgets(line, sizeof(line), stdin)) {
+		if (sscanf(line, "T %u %hu %hu %hu %hu %hu %hu", &us, &items[0], &items[1],
+		           &items[2], &items[3], &items[4], &items[5]) != 1 + DETECT_CHANNELS) {
+			continue;
+		}
+		frames++;
+		frame_us = us;
+		detect_levels(&detect, items);
+		if ((t = step(matchers, items, us)) > trace_max) {
+			trace_max = t;
+		}
+		detect_fingers(&detect, items, finger);
+	}
+
+	gesture_init(&gestures, gesture_templates, matchers, GESTURE_TEMPLATES, emit);
+	// frames far enough apart that no template is pending after a lift
+	for (i = 0, us = 0; i < BENCH_FRAMES; i++, us += GESTURE_STEP_US + 1) {
+		for (f = 0; f < GESTURE_FINGERS; f++) {
+			items[f] = i & 1 ? 0 : GESTURE_PRESS;
+		}
+		gestures.nheld = GESTURE_HELD;
+		if ((t = step(matchers, items, us)) > worst_max) {
+			worst_max = t;
+		}
+	}
+
+	budget = GESTURE_BUDGET_CYCLES * 1000ull / CPU_MHZ / HOST_SPEEDUP;
+	printf("gesture_step: %lu ns over %lu trace frames, %lu ns made up, budget %lu ns\n",
+		(unsigned long)trace_max, (unsigned long)frames, (unsigned long)worst_max, (unsigned long)budget);
+	if (trace_max > budget || worst_max > budget) {
+		fprintf(stderr, "gesture_step over its budget of %d cycles\n", GESTURE_BUDGET_CYCLES);
+		return 1;
+	}
+	return 0;
+}
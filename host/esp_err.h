@@ -0,0 +1,18 @@
+#pragma once
+
+#include <stdint.h>
+
+/* The few ESP-IDF error codes the shared modules use, for host builds. */
+typedef int esp_err_t;
+
+#define ESP_OK                       0
+#define ESP_FAIL                    -1
+#define ESP_ERR_NO_MEM           0x101
+#define ESP_ERR_INVALID_ARG      0x102
+#define ESP_ERR_INVALID_STATE    0x103
+#define ESP_ERR_INVALID_SIZE     0x104
+#define ESP_ERR_NOT_FOUND        0x105
+#define ESP_ERR_INVALID_VERSION  0x10a
+#define ESP_ERR_NOT_FINISHED     0x10c
+
+const char *esp_err_to_name(esp_err_t err);
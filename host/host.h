@@ -0,0 +1,13 @@
+#include <stdint.h>
+
+/*
+ * Outputs for a Linux host.  Both write synchronously, so the caller
+ * retires each report with report_done once report_pump returns.
+ */
+struct Output;
+
+extern const struct Output sim_output;		// prints reports to stdout
+extern const struct Output uinput_output;	// types them through /dev/uinput
+
+int uinput_open(const char *name);
+void uinput_close(void);
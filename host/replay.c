@@ -0,0 +1,192 @@
+/*
+ * Replays a sensing trace through the firmware's detection, gestures,
+ * keymap, key state and report queue, and hands the reports to a host
+ * Output: sim prints them, uinput types them on this machine.  Traces are
+ * the "T us raw..." lines main.c prints with TRACE set; anything else is
+ * skipped, so a serial log can be fed in as captured.
+ *
+ *	replay [-u] [-r] [-k keymap.bin] [-b base] < trace
+ *
+ * -u types through uinput instead of printing, -r keeps the trace's
+ * pacing, -k takes a keymap blob as uploaded over cfg, -b is the keymap
+ * base of the half that recorded the trace (24 for the left).
+ */
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "esp_log.h"
+#include "detect.h"
+#include "gesture.h"
+#include "host.h"
+#include "keymap.h"
+#include "keys.h"
+#include "output.h"
+#include "prof.h"
+#include "report.h"
+#include "ring.h"
+#include "usage.h"
+
+#define ROWS                        32	// stick levels, the display height on the board
+
+static const char *TAG = "replay";
+
+static const Output *out = &sim_output;
+static Keys keys;
+static uint32_t arrived;	// when the frame being processed was read
+static uint32_t taps, skipped;
+
+static uint32_t now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000ull + ts.tv_nsec / 1000;
+}
+
+// the host outputs are synchronous, so whatever went out has completed
+static void drain(void)
+{
+	int i, ret;
+
+	while (report_pending()) {
+		if ((ret = report_pump(now())) != 0) {
+			ESP_LOGE(TAG, "%s failed (%d), dropping %d reports", out->name, ret, report_pending());
+			report_reset();
+			return;
+		}
+		for (i = 0; i < REPORT_WINDOW; i++) {
+			report_done(now());
+		}
+	}
+}
+
+// like the sender's queue_report: wait for room behind what is queued
+static int queue(const Report *r)
+{
+	while (!report_queue(r)) {
+		drain();
+	}
+	return 0;
+}
+
+// a press and a release, as emit_local puts them on the sender's ring
+static void emit(int idx, int ch)
+{
+	Key key = keymap_key(idx);
+	Event ev = { .us = arrived, .ch = ch, .code = key.hid, .act = key.act };
+
+	taps++;
+	ev.flags = EV_PRESS;
+	if (!keys_event(&keys, &ev)) {
+		skipped++;
+		return;
+	}
+	ev.flags = 0;
+	keys_event(&keys, &ev);
+}
+
+static Gestures gestures;
+static uint32_t frame_us;	// trace time of the frame being processed
+
+static void finger(int idx, int ch)
+{
+	gesture_tap(&gestures, idx, ch, frame_us);
+}
+
+static int keymap(const char *path)
+{
+	uint8_t blob[1+KEYMAP_LEN*3];
+	size_t n;
+	FILE *f;
+
+	if ((f = fopen(path, "rb")) == NULL) {
+		return -1;
+	}
+	n = fread(blob, 1, sizeof(blob), f);
+	fclose(f);
+	return keymap_store(blob, n) == ESP_OK ? 0 : -1;
+}
+
+int main(int argc, char *argv[])
+{
+	char line[256];
+	uint16_t items[DETECT_CHANNELS];
+	uint32_t us, first = 0, start = 0, frames = 0;
+	bool paced = false;
+	int base = 24, opt, g;
+	Detect detect;
+	Matcher matchers[GESTURE_TEMPLATES];
+	Hist frame;
+
+	keymap_load();
+	while ((opt = getopt(argc, argv, "urk:b:")) != -1) {
+		switch (opt) {
+		case 'u':
+			if (uinput_open("lask5 replay") < 0) {
+				perror("uinput");
+				return 1;
+			}
+			out = &uinput_output;
+			// give the desktop time to pick the device up
+			sleep(1);
+			break;
+		case 'r':
+			paced = true;
+			break;
+		case 'k':
+			if (keymap(optarg) < 0) {
+				fprintf(stderr, "%s: bad keymap\n", optarg);
+				return 1;
+			}
+			break;
+		case 'b':
+			base = atoi(optarg);
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-u] [-r] [-k keymap.bin] [-b base] < trace\n", argv[0]);
+			return 1;
+		}
+	}
+
+	report_init(out->send);
+	report_coalesce(HID_RPT_ID_KEY_IN, report_merge_keys);
+	report_coalesce(HID_RPT_ID_CC_IN, report_merge_same);
+	keys_init(&keys, queue, NULL, 0);
+	detect_init(&detect, base, ROWS);
+	gesture_init(&gestures, gesture_templates, matchers, GESTURE_TEMPLATES, emit);
+	hist_init(&frame, "frame to reports", 10);
+
+	while (fgets(line, sizeof(line), stdin)) {
+		if (sscanf(line, "T %u %hu %hu %hu %hu %hu %hu", &us, &items[0], &items[1],
+		           &items[2], &items[3], &items[4], &items[5]) != 1 + DETECT_CHANNELS) {
+			continue;
+		}
+		if (!frames++) {
+			first = us;
+			start = now();
+		}
+		if (paced && (int32_t)((us - first) - (now() - start)) > 0) {
+			usleep((us - first) - (now() - start));
+		}
+
+		arrived = now();
+		frame_us = us;
+		detect_levels(&detect, items);
+		if ((g = gesture_step(&gestures, items, us)) >= 0) {
+			emit(KEYMAP_GESTURE + g, GESTURE_FINGERS + g);
+		}
+		detect_fingers(&detect, items, finger);
+		drain();
+		hist_add(&frame, now() - arrived);
+	}
+
+	ESP_LOGI(TAG, "%lu frames, %lu taps, %lu not typed", (unsigned long)frames, (unsigned long)taps, (unsigned long)skipped);
+	hist_log(&frame);
+	hist_log(report_latency());
+	uinput_close();
+	return 0;
+}
@@ -0,0 +1,40 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include "host.h"
+#include "output.h"
+#include "report.h"
+
+static bool ready(void)
+{
+	return true;
+}
+
+// one line per report: input time, report id, then the bytes in hex
+static int send(const Report *r)
+{
+	int i;
+
+	printf("R %lu %u", (unsigned long)r->us, r->id);
+	for (i = 0; i < r->len; i++) {
+		printf(" %02x", r->data[i]);
+	}
+	putchar('\n');
+	return 0;
+}
+
+static uint8_t resolution(void)
+{
+	return 0;
+}
+
+static uint32_t interval(void)
+{
+	return 1000;
+}
+
+static void activity(void)
+{
+}
+
+const Output sim_output = { "sim", ready, send, resolution, interval, activity };
@@ -0,0 +1,299 @@
+/*
+ * Stress test for the report queue.  Random key, mouse and consumer
+ * input goes through report_queue while the link congests, refuses
+ * notifies and completes them in random order.  The host must end up
+ * in the state the uncoalesced stream left, see every key transition in
+ * stream order, get all mouse motion and every consumer state change.
+ *
+ *	test_report [runs] [steps]
+ */
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "report.h"
+#include "usage.h"
+
+#define LENGTH(x)  ((int)(sizeof (x) / sizeof *(x)))
+
+#define KEYS                         6	// usages 4..9, few so they repeat
+#define MODS                         3
+#define CODES        (KEYS + MODS)	// keys, then the modifier bits
+#define TRANSITIONS              65536
+#define MOUSE_LEN                    5	// HID_RPT_LEN_MOUSE_IN
+#define CC_LEN                       2	// HID_RPT_LEN_CC_IN
+
+static uint32_t seed;
+static int run;
+
+// what the stream put in, uncoalesced
+static struct {
+	bool down[CODES];
+	uint32_t at[CODES][TRANSITIONS/CODES];	// stream order of each transition of a code
+	int n[CODES];
+	int32_t motion[2];
+	uint8_t buttons;
+	uint8_t cc[CC_LEN];
+	uint8_t states[TRANSITIONS][CC_LEN];	// consumer states in the order they changed
+	int nstates;
+} in;
+
+// what the host saw
+static struct {
+	bool down[CODES];
+	int seen[CODES];
+	uint32_t after;	// stream order of the last transition already seen
+	uint32_t us;
+	int32_t motion[2];
+	uint8_t buttons;
+	uint8_t cc[CC_LEN];
+	int nstates;
+	uint32_t reports, refused;
+} host;
+
+static uint32_t window, order;
+static uint32_t now;
+
+static uint32_t rnd(void)
+{
+	seed ^= seed << 13;
+	seed ^= seed >> 17;
+	seed ^= seed << 5;
+	return seed;
+}
+
+static void fail(const char *what)
+{
+	fprintf(stderr, "run %d: %s, after %lu reports\n", run, what, (unsigned long)host.reports);
+	exit(1);
+}
+
+static bool has(const Report *r, uint8_t key)
+{
+	int i;
+
+	for (i = 2; i < r->len; i++) {
+		if (r->data[i] == key) {
+			return true;
+		}
+	}
+	return false;
+}
+
+static void keys(const Report *r)
+{
+	uint32_t first = ~0, last = 0, at;
+	bool down;
+	int c;
+
+	for (c = 0; c < CODES; c++) {
+		down = c < KEYS ? has(r, 4 + c) : r->data[0] >> (c - KEYS) & 1;
+		if (down == host.down[c]) {
+			continue;
+		}
+		if (host.seen[c] >= in.n[c]) {
+			fail("transition the stream never made");
+		}
+		at = in.at[c][host.seen[c]++];
+		first = at < first ? at : first;
+		last = at > last ? at : last;
+		host.down[c] = down;
+	}
+	if (last && first <= host.after) {
+		fail("transition seen out of stream order");
+	}
+	host.after = last ? last : host.after;
+}
+
+static int send(const Report *r)
+{
+	// the stack turns notifies away now and then, the report stays queued
+	if (rnd() % 16 == 0) {
+		host.refused++;
+		return -1;
+	}
+	if (window >= REPORT_WINDOW) {
+		fail("window overrun");
+	}
+	if (r->us <= host.us) {
+		fail("reports reordered");
+	}
+	host.us = r->us;
+	host.reports++;
+	window++;
+	switch (r->id) {
+	case HID_RPT_ID_KEY_IN:
+		keys(r);
+		break;
+	case HID_RPT_ID_MOUSE_IN:
+		host.buttons = r->data[0];
+		host.motion[0] += (int8_t)r->data[1];
+		host.motion[1] += (int8_t)r->data[2];
+		break;
+	case HID_RPT_ID_CC_IN:
+		if (memcmp(host.cc, r->data, CC_LEN)) {
+			if (host.nstates >= in.nstates || memcmp(in.states[host.nstates], r->data, CC_LEN)) {
+				fail("consumer state the stream never had");
+			}
+			host.nstates++;
+			memcpy(host.cc, r->data, CC_LEN);
+		}
+		break;
+	}
+	return 0;
+}
+
+static void complete(void)
+{
+	if (window) {
+		window--;
+		report_done(now);
+	}
+}
+
+static void step(void)
+{
+	now += 100;
+	switch (rnd() % 8) {
+	case 0:
+		report_congest(rnd() % 2);
+		break;
+	case 1: case 2: case 3:
+		complete();
+		break;
+	}
+	report_pump(now);
+}
+
+// like the firmware's queue_report: wait for room behind what is queued
+static void queue(Report *r)
+{
+	r->us = ++order;
+	while (!report_queue(r)) {
+		complete();
+		step();
+	}
+	step();
+}
+
+static void queue_keys(void)
+{
+	Report r = { .id = HID_RPT_ID_KEY_IN, .len = 8 };
+	int c, n = 2;
+
+	for (c = 0; c < CODES; c++) {
+		if (!in.down[c]) {
+			continue;
+		}
+		if (c < KEYS) {
+			r.data[n++] = 4 + c;
+		} else {
+			r.data[0] |= 1 << (c - KEYS);
+		}
+	}
+	queue(&r);
+}
+
+static void input(void)
+{
+	Report r = { 0 };
+	int c;
+
+	switch (rnd() % 4) {
+	case 0: case 1:
+		c = rnd() % CODES;
+		in.down[c] = !in.down[c];
+		in.at[c][in.n[c]++] = order + 1;
+		queue_keys();
+		break;
+	case 2:
+		r.id = HID_RPT_ID_MOUSE_IN;
+		r.len = MOUSE_LEN;
+		if (rnd() % 16 == 0) {
+			in.buttons ^= 1 << rnd() % 3;
+		}
+		r.data[0] = in.buttons;
+		r.data[1] = (int8_t)(rnd() % 255 - 127);
+		r.data[2] = (int8_t)(rnd() % 255 - 127);
+		in.motion[0] += (int8_t)r.data[1];
+		in.motion[1] += (int8_t)r.data[2];
+		queue(&r);
+		break;
+	case 3:
+		r.id = HID_RPT_ID_CC_IN;
+		r.len = CC_LEN;
+		// mostly repeats, which are what merge_same folds
+		if (rnd() % 4 == 0) {
+			in.cc[0] ^= 1 << rnd() % 8;
+			memcpy(in.states[in.nstates++], in.cc, CC_LEN);
+		}
+		memcpy(r.data, in.cc, CC_LEN);
+		queue(&r);
+		break;
+	}
+}
+
+static void check(void)
+{
+	int c;
+
+	for (c = 0; c < CODES; c++) {
+		if (host.down[c] != in.down[c]) {
+			fail("key state differs at the end");
+		}
+		if (host.seen[c] != in.n[c]) {
+			fail("transitions lost");
+		}
+	}
+	if (host.motion[0] != in.motion[0] || host.motion[1] != in.motion[1] || host.buttons != in.buttons) {
+		fail("mouse differs at the end");
+	}
+	if (host.nstates != in.nstates || memcmp(host.cc, in.cc, CC_LEN)) {
+		fail("consumer states lost");
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	int runs = argc > 1 ? atoi(argv[1]) : 200;
+	int steps = argc > 2 ? atoi(argv[2]) : 2000;
+	uint32_t merged = 0, reports = 0, refused = 0;
+	int i;
+
+	if (steps > TRANSITIONS/CODES) {
+		steps = TRANSITIONS/CODES;
+	}
+	for (run = 1; run <= runs; run++) {
+		seed = run * 2654435761u;
+		memset(&in, 0, sizeof(in));
+		memset(&host, 0, sizeof(host));
+		window = order = now = 0;
+		report_init(send);
+		report_coalesce(HID_RPT_ID_KEY_IN, report_merge_keys);
+		report_coalesce(HID_RPT_ID_MOUSE_IN, report_merge_mouse);
+		report_coalesce(HID_RPT_ID_CC_IN, report_merge_same);
+		report_congest(false);
+		merged -= report_merged();
+
+		for (i = 0; i < steps; i++) {
+			input();
+		}
+		report_congest(false);
+		while (report_pending()) {
+			complete();
+			now += 100;
+			report_pump(now);
+		}
+		check();
+		merged += report_merged();
+		reports += host.reports;
+		refused += host.refused;
+	}
+	if (report_lost()) {
+		fail("completions timed out");
+	}
+	printf("ok: %d runs of %d inputs, %lu reports sent, %lu coalesced, %lu notifies refused\n",
+		runs, steps, (unsigned long)reports, (unsigned long)merged, (unsigned long)refused);
+	return 0;
+}
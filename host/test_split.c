@@ -0,0 +1,190 @@
+/*
+ * Runs the split protocol between two halves over loopbacks with delay
+ * and loss.  Taps must reach the primary in order and at most once, and
+ * every tap must arrive unless the sender gave it up, in which case the
+ * receiver counts it skipped.  Without loss every tap arrives, nothing is
+ * given up and each ack takes one round trip.
+ *
+ *	test_split [taps]
+ */
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "split.h"
+
+#define LENGTH(x)  ((int)(sizeof (x) / sizeof *(x)))
+
+#define STEP_US                    250
+#define DRAIN_US               1000000
+
+static const struct {
+	uint32_t delay, loss;
+	uint32_t every;	// us between taps
+} cases[] = {
+	{ 1000, 0, 1000 },
+	{ 4000, 0, 1000 },
+	{ 8000, 0, 1000 },	// round trip past SPLIT_RTO_US: resends, no give ups
+	{ 2000, 7, 1000 },	// the next tap's frame carries a lost one
+	{ 2000, 3, 1000 },
+	{ 2000, 2, 1000 },
+	{ 2000, 3, 50000 },	// taps sparse enough that lost ones are resent
+	{ 2000, 2, 50000 },
+	{ 3000, 1, 1000 },	// all lost
+};
+
+static struct {
+	uint32_t n;
+	int32_t last;	// value of the last tap delivered
+} got;
+
+static struct {
+	uint32_t offered, answered;
+	bool taken;
+} role;
+
+static int c;
+static Split sec, pri;
+static Loopback to_pri, to_sec;
+static uint32_t now;
+
+static void fail(const char *what)
+{
+	fflush(stdout);
+	fprintf(stderr, "delay %lu us, loss 1/%lu: %s\n", (unsigned long)cases[c].delay,
+		(unsigned long)cases[c].loss, what);
+	exit(1);
+}
+
+static void deliver(const Tap *t, void *ctx)
+{
+	int32_t v = t->key | t->ch << 8;
+
+	if (v <= got.last) {
+		fail(v == got.last ? "tap delivered twice" : "tap delivered out of order");
+	}
+	got.last = v;
+	got.n++;
+}
+
+static bool offered(uint8_t side, uint8_t primary, void *ctx)
+{
+	if (side != 1 || primary != 2) {
+		fail("offer garbled");
+	}
+	role.offered++;
+	return true;
+}
+
+static void answered(bool taken, void *ctx)
+{
+	role.answered++;
+	role.taken = taken;
+}
+
+static void step(void)
+{
+	now += STEP_US;
+	// acks go out from inside to_pri's run and are stamped with to_sec's clock
+	loopback_run(&to_sec, now);
+	loopback_run(&to_pri, now);
+	split_poll(&sec, now);
+	split_poll(&pri, now);
+}
+
+// the first and last taps go through without loss, so the receiver syncs
+// on the first and the last one shows what was skipped before it
+static void tap(uint32_t v, bool lossless)
+{
+	Tap t = { v & 0xff, v >> 8 };
+	uint32_t loss = to_pri.loss;
+
+	if (lossless) {
+		to_pri.loss = to_sec.loss = 0;
+	}
+	while (!split_tap(&sec, &t, now)) {
+		step();
+	}
+	if (lossless) {
+		while (sec.base != sec.next) {
+			step();
+		}
+		to_pri.loss = to_sec.loss = loss;
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	uint32_t taps = argc > 1 ? atoi(argv[1]) : 5000;
+	uint32_t v, rtt, end;
+
+	if (taps < 2 || taps > 0xffff) {
+		taps = 5000;
+	}
+	for (c = 0; c < LENGTH(cases); c++) {
+		memset(&got, 0, sizeof(got));
+		memset(&role, 0, sizeof(role));
+		got.last = -1;
+		now = 0;
+		loopback_init(&to_pri, &pri, cases[c].delay, cases[c].loss);
+		loopback_init(&to_sec, &sec, cases[c].delay, cases[c].loss);
+		split_init(&sec, &to_pri.tx, 1, NULL, offered, NULL, NULL);
+		split_init(&pri, &to_sec.tx, 2, deliver, NULL, answered, NULL);
+
+		for (v = 0; v < taps; v++) {
+			tap(v, v == 0 || v == taps - 1);
+			step();
+			while (now % cases[c].every) {
+				step();
+			}
+		}
+		split_offer(&pri, 1, 2, now);
+		for (end = now + DRAIN_US; now < end; ) {
+			step();
+		}
+
+		if (sec.base != sec.next) {
+			fail("taps still in flight");
+		}
+		if (got.n + pri.skipped != taps) {
+			fail("taps neither delivered nor skipped");
+		}
+		if (pri.skipped > sec.gaveup) {
+			fail("receiver skipped taps the sender did not give up");
+		}
+		if (sec.rtt_n + sec.gaveup != taps) {
+			fail("taps neither acked nor given up");
+		}
+		rtt = 2*cases[c].delay;
+		if (sec.rtt_n && sec.rtt_sum / sec.rtt_n < rtt) {
+			fail("acked faster than a round trip");
+		}
+		if (!cases[c].loss) {
+			if (got.n != taps || sec.gaveup || pri.skipped) {
+				fail("taps lost on a lossless link");
+			}
+			if (sec.rtt_max > rtt + 2*STEP_US) {
+				fail("ack took longer than a round trip on a lossless link");
+			}
+		}
+		if (role.answered != 1 || role.taken != (cases[c].loss != 1)) {
+			fail("role offer not answered once");
+		}
+		if (role.taken && !role.offered) {
+			fail("role offer taken but never seen");
+		}
+		// the last frame carries whatever the window still held
+		if (cases[c].loss == 1 && got.n > 2 + SPLIT_WINDOW) {
+			fail("taps delivered over a dead link");
+		}
+		printf("delay %5lu us, loss 1/%lu: %lu delivered, %lu skipped, %lu given up, "
+			"%lu resent, %lu dups, rtt mean %lu max %lu us\n",
+			(unsigned long)cases[c].delay, (unsigned long)cases[c].loss,
+			(unsigned long)got.n, (unsigned long)pri.skipped, (unsigned long)sec.gaveup,
+			(unsigned long)sec.resent, (unsigned long)pri.dups,
+			(unsigned long)(sec.rtt_n ? sec.rtt_sum / sec.rtt_n : 0), (unsigned long)sec.rtt_max);
+	}
+	printf("ok: %d links, %lu taps each\n", LENGTH(cases), (unsigned long)taps);
+	return 0;
+}
@@ -0,0 +1,256 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <linux/uinput.h>
+#include "host.h"
+#include "output.h"
+#include "report.h"
+#include "usage.h"
+
+#define LENGTH(x)  ((int)(sizeof (x) / sizeof *(x)))
+
+// HID keyboard usages to Linux key codes
+static const uint16_t keys[256] = {
+	[HID_KEY_A] = KEY_A,              [HID_KEY_B] = KEY_B,              [HID_KEY_C] = KEY_C,
+	[HID_KEY_D] = KEY_D,              [HID_KEY_E] = KEY_E,              [HID_KEY_F] = KEY_F,
+	[HID_KEY_G] = KEY_G,              [HID_KEY_H] = KEY_H,              [HID_KEY_I] = KEY_I,
+	[HID_KEY_J] = KEY_J,              [HID_KEY_K] = KEY_K,              [HID_KEY_L] = KEY_L,
+	[HID_KEY_M] = KEY_M,              [HID_KEY_N] = KEY_N,              [HID_KEY_O] = KEY_O,
+	[HID_KEY_P] = KEY_P,              [HID_KEY_Q] = KEY_Q,              [HID_KEY_R] = KEY_R,
+	[HID_KEY_S] = KEY_S,              [HID_KEY_T] = KEY_T,              [HID_KEY_U] = KEY_U,
+	[HID_KEY_V] = KEY_V,              [HID_KEY_W] = KEY_W,              [HID_KEY_X] = KEY_X,
+	[HID_KEY_Y] = KEY_Y,              [HID_KEY_Z] = KEY_Z,              [HID_KEY_1] = KEY_1,
+	[HID_KEY_2] = KEY_2,              [HID_KEY_3] = KEY_3,              [HID_KEY_4] = KEY_4,
+	[HID_KEY_5] = KEY_5,              [HID_KEY_6] = KEY_6,              [HID_KEY_7] = KEY_7,
+	[HID_KEY_8] = KEY_8,              [HID_KEY_9] = KEY_9,              [HID_KEY_0] = KEY_0,
+	[HID_KEY_RETURN] = KEY_ENTER,     [HID_KEY_ESCAPE] = KEY_ESC,       [HID_KEY_DELETE] = KEY_BACKSPACE,
+	[HID_KEY_TAB] = KEY_TAB,          [HID_KEY_SPACEBAR] = KEY_SPACE,   [HID_KEY_MINUS] = KEY_MINUS,
+	[HID_KEY_EQUAL] = KEY_EQUAL,      [HID_KEY_LEFT_BRKT] = KEY_LEFTBRACE, [HID_KEY_RIGHT_BRKT] = KEY_RIGHTBRACE,
+	[HID_KEY_BACK_SLASH] = KEY_BACKSLASH, [HID_KEY_SEMI_COLON] = KEY_SEMICOLON, [HID_KEY_SGL_QUOTE] = KEY_APOSTROPHE,
+	[HID_KEY_GRV_ACCENT] = KEY_GRAVE, [HID_KEY_COMMA] = KEY_COMMA,      [HID_KEY_DOT] = KEY_DOT,
+	[HID_KEY_FWD_SLASH] = KEY_SLASH,  [HID_KEY_CAPS_LOCK] = KEY_CAPSLOCK,
+	[HID_KEY_F1] = KEY_F1,            [HID_KEY_F2] = KEY_F2,            [HID_KEY_F3] = KEY_F3,
+	[HID_KEY_F4] = KEY_F4,            [HID_KEY_F5] = KEY_F5,            [HID_KEY_F6] = KEY_F6,
+	[HID_KEY_F7] = KEY_F7,            [HID_KEY_F8] = KEY_F8,            [HID_KEY_F9] = KEY_F9,
+	[HID_KEY_F10] = KEY_F10,          [HID_KEY_F11] = KEY_F11,          [HID_KEY_F12] = KEY_F12,
+	[HID_KEY_PRNT_SCREEN] = KEY_SYSRQ, [HID_KEY_SCROLL_LOCK] = KEY_SCROLLLOCK, [HID_KEY_PAUSE] = KEY_PAUSE,
+	[HID_KEY_INSERT] = KEY_INSERT,    [HID_KEY_HOME] = KEY_HOME,        [HID_KEY_PAGE_UP] = KEY_PAGEUP,
+	[HID_KEY_DELETE_FWD] = KEY_DELETE, [HID_KEY_END] = KEY_END,         [HID_KEY_PAGE_DOWN] = KEY_PAGEDOWN,
+	[HID_KEY_RIGHT_ARROW] = KEY_RIGHT, [HID_KEY_LEFT_ARROW] = KEY_LEFT, [HID_KEY_DOWN_ARROW] = KEY_DOWN,
+	[HID_KEY_UP_ARROW] = KEY_UP,      [HID_KEY_NUM_LOCK] = KEY_NUMLOCK, [HID_KEY_DIVIDE] = KEY_KPSLASH,
+	[HID_KEY_MULTIPLY] = KEY_KPASTERISK, [HID_KEY_SUBTRACT] = KEY_KPMINUS, [HID_KEY_ADD] = KEY_KPPLUS,
+	[HID_KEY_ENTER] = KEY_KPENTER,    [HID_KEY_MUTE] = KEY_MUTE,        [HID_KEY_VOLUME_UP] = KEY_VOLUMEUP,
+	[HID_KEY_VOLUME_DOWN] = KEY_VOLUMEDOWN,
+};
+
+// modifier byte, bit by bit
+static const uint16_t mods[8] = {
+	KEY_LEFTCTRL, KEY_LEFTSHIFT, KEY_LEFTALT, KEY_LEFTMETA,
+	KEY_RIGHTCTRL, KEY_RIGHTSHIFT, KEY_RIGHTALT, KEY_RIGHTMETA,
+};
+
+// consumer report button field
+static const uint16_t media[16] = {
+	[HID_CC_RPT_MUTE] = KEY_MUTE,               [HID_CC_RPT_POWER] = KEY_POWER,
+	[HID_CC_RPT_PLAY] = KEY_PLAYCD,             [HID_CC_RPT_PAUSE] = KEY_PAUSECD,
+	[HID_CC_RPT_RECORD] = KEY_RECORD,           [HID_CC_RPT_FAST_FWD] = KEY_FASTFORWARD,
+	[HID_CC_RPT_REWIND] = KEY_REWIND,           [HID_CC_RPT_SCAN_NEXT_TRK] = KEY_NEXTSONG,
+	[HID_CC_RPT_SCAN_PREV_TRK] = KEY_PREVIOUSSONG, [HID_CC_RPT_STOP] = KEY_STOPCD,
+};
+
+static const uint16_t buttons[3] = { BTN_LEFT, BTN_RIGHT, BTN_MIDDLE };
+
+static int fd = -1;
+static Report last[REPORT_IDS];	// what the host has been told, to send only changes
+
+static void emit(uint16_t type, uint16_t code, int32_t value)
+{
+	struct input_event ev = { .type = type, .code = code, .value = value };
+
+	if (write(fd, &ev, sizeof(ev)) != sizeof(ev)) {
+		close(fd);
+		fd = -1;
+	}
+}
+
+static bool has(const uint8_t *set, int n, uint8_t key)
+{
+	int i;
+
+	for (i = 0; i < n; i++) {
+		if (set[i] == key) {
+			return true;
+		}
+	}
+	return false;
+}
+
+static void keyboard(const Report *prev, const Report *r)
+{
+	int i;
+
+	for (i = 0; i < 8; i++) {
+		if ((prev->data[0] ^ r->data[0]) & 1 << i) {
+			emit(EV_KEY, mods[i], r->data[0] >> i & 1);
+		}
+	}
+	// releases first, so a key that moved slots is not lost
+	for (i = 2; i < 8; i++) {
+		if (prev->data[i] && keys[prev->data[i]] && !has(&r->data[2], 6, prev->data[i])) {
+			emit(EV_KEY, keys[prev->data[i]], 0);
+		}
+	}
+	for (i = 2; i < 8; i++) {
+		if (r->data[i] && keys[r->data[i]] && !has(&prev->data[2], 6, r->data[i])) {
+			emit(EV_KEY, keys[r->data[i]], 1);
+		}
+	}
+}
+
+static void mouse(const Report *prev, const Report *r)
+{
+	int i;
+
+	for (i = 0; i < LENGTH(buttons); i++) {
+		if ((prev->data[0] ^ r->data[0]) & 1 << i) {
+			emit(EV_KEY, buttons[i], r->data[0] >> i & 1);
+		}
+	}
+	if (r->data[1]) {
+		emit(EV_REL, REL_X, (int8_t)r->data[1]);
+	}
+	if (r->data[2]) {
+		emit(EV_REL, REL_Y, (int8_t)r->data[2]);
+	}
+	if (r->data[3]) {
+		emit(EV_REL, REL_WHEEL, (int8_t)r->data[3]);
+	}
+	if (r->data[4]) {
+		emit(EV_REL, REL_HWHEEL, (int8_t)r->data[4]);
+	}
+}
+
+static void consumer(const Report *prev, const Report *r)
+{
+	uint8_t was = prev->data[1] & 0x0f, is = r->data[1] & 0x0f;
+	uint8_t vol = r->data[0] & ~HID_CC_RPT_VOLUME_BITS, pvol = prev->data[0] & ~HID_CC_RPT_VOLUME_BITS;
+
+	if (was != is && media[was]) {
+		emit(EV_KEY, media[was], 0);
+	}
+	if (was != is && media[is]) {
+		emit(EV_KEY, media[is], 1);
+	}
+	if (vol != pvol) {
+		if (pvol & HID_CC_RPT_VOLUME_UP) {
+			emit(EV_KEY, KEY_VOLUMEUP, 0);
+		}
+		if (pvol & HID_CC_RPT_VOLUME_DOWN) {
+			emit(EV_KEY, KEY_VOLUMEDOWN, 0);
+		}
+		if (vol & HID_CC_RPT_VOLUME_UP) {
+			emit(EV_KEY, KEY_VOLUMEUP, 1);
+		}
+		if (vol & HID_CC_RPT_VOLUME_DOWN) {
+			emit(EV_KEY, KEY_VOLUMEDOWN, 1);
+		}
+	}
+}
+
+static bool ready(void)
+{
+	return fd >= 0;
+}
+
+static int send(const Report *r)
+{
+	if (fd < 0) {
+		return -1;
+	}
+	switch (r->id) {
+	case HID_RPT_ID_KEY_IN:
+		keyboard(&last[r->id], r);
+		break;
+	case HID_RPT_ID_MOUSE_IN:
+		mouse(&last[r->id], r);
+		break;
+	case HID_RPT_ID_CC_IN:
+		consumer(&last[r->id], r);
+		break;
+	default:
+		return REPORT_DROP;
+	}
+	emit(EV_SYN, SYN_REPORT, 0);
+	last[r->id] = *r;
+	return fd >= 0 ? 0 : -1;
+}
+
+static uint8_t resolution(void)
+{
+	return 0;
+}
+
+static uint32_t interval(void)
+{
+	return 1000;
+}
+
+static void activity(void)
+{
+}
+
+const Output uinput_output = { "uinput", ready, send, resolution, interval, activity };
+
+int uinput_open(const char *name)
+{
+	struct uinput_setup setup = { .id = { .bustype = BUS_VIRTUAL, .vendor = 0x1209, .product = 0x0001 } };
+	int i;
+
+	if ((fd = open("/dev/uinput", O_WRONLY | O_NONBLOCK)) < 0) {
+		return -1;
+	}
+	ioctl(fd, UI_SET_EVBIT, EV_KEY);
+	ioctl(fd, UI_SET_EVBIT, EV_REL);
+	for (i = 0; i < LENGTH(keys); i++) {
+		if (keys[i]) {
+			ioctl(fd, UI_SET_KEYBIT, keys[i]);
+		}
+	}
+	for (i = 0; i < LENGTH(mods); i++) {
+		ioctl(fd, UI_SET_KEYBIT, mods[i]);
+	}
+	for (i = 0; i < LENGTH(media); i++) {
+		if (media[i]) {
+			ioctl(fd, UI_SET_KEYBIT, media[i]);
+		}
+	}
+	for (i = 0; i < LENGTH(buttons); i++) {
+		ioctl(fd, UI_SET_KEYBIT, buttons[i]);
+	}
+	ioctl(fd, UI_SET_KEYBIT, KEY_VOLUMEUP);
+	ioctl(fd, UI_SET_KEYBIT, KEY_VOLUMEDOWN);
+	ioctl(fd, UI_SET_RELBIT, REL_X);
+	ioctl(fd, UI_SET_RELBIT, REL_Y);
+	ioctl(fd, UI_SET_RELBIT, REL_WHEEL);
+	ioctl(fd, UI_SET_RELBIT, REL_HWHEEL);
+	strncpy(setup.name, name, sizeof(setup.name)-1);
+	if (ioctl(fd, UI_DEV_SETUP, &setup) < 0 || ioctl(fd, UI_DEV_CREATE) < 0) {
+		close(fd);
+		fd = -1;
+		return -1;
+	}
+	memset(last, 0, sizeof(last));
+	return 0;
+}
+
+void uinput_close(void)
+{
+	if (fd >= 0) {
+		ioctl(fd, UI_DEV_DESTROY);
+		close(fd);
+		fd = -1;
+	}
+}
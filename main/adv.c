@@ -0,0 +1,153 @@
+#include <string.h>
+#include <stdatomic.h>
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_gap_ble_api.h"
+#include "adv.h"
+
+#define LENGTH(x)  ((int)(sizeof (x) / sizeof *(x)))
+
+static const char *TAG = "adv";
+
+static const char *names[] = {
+	[ADV_IDLE] = "idle",
+	[ADV_DIRECT] = "directed",
+	[ADV_ACCEPT] = "accept list",
+	[ADV_OPEN] = "open",
+};
+
+static esp_ble_adv_params_t params;
+static esp_timer_handle_t timer;
+static _Atomic int phase = ADV_IDLE;
+static _Atomic int next = ADV_IDLE;	// phase to start once advertising stops
+static int bonded;
+
+static void start(int p)
+{
+	esp_ble_adv_params_t a = params;
+
+	if (p == ADV_ACCEPT && !bonded) {
+		p = ADV_OPEN;
+	}
+	phase = p;
+	switch (p) {
+	case ADV_DIRECT:
+		a.adv_type = ADV_TYPE_DIRECT_IND_HIGH;
+		esp_timer_start_once(timer, ADV_DIRECT_US);
+		break;
+	case ADV_ACCEPT:
+		a.adv_filter_policy = ADV_FILTER_ALLOW_SCAN_ANY_CON_WLST;
+		esp_timer_start_once(timer, ADV_ACCEPT_US);
+		break;
+	case ADV_OPEN:
+		break;
+	default:
+		return;
+	}
+	esp_ble_gap_start_advertising(&a);
+	ESP_LOGI(TAG, "advertising %s", names[p]);
+}
+
+// advertising parameters can't change while running, so stop first
+static void restart(int p)
+{
+	if (phase == ADV_IDLE) {
+		start(p);
+		return;
+	}
+	next = p;
+	esp_ble_gap_stop_advertising();
+}
+
+// step down the ladder, the next phase starts from adv_stopped
+static void expire(void *arg)
+{
+	int p = phase;
+
+	if (p == ADV_DIRECT || p == ADV_ACCEPT) {
+		restart(p + 1);
+	}
+}
+
+esp_err_t adv_init(const esp_ble_adv_params_t *open)
+{
+	esp_timer_create_args_t args = {
+		.callback = expire,
+		.name = "adv",
+	};
+
+	params = *open;
+	return esp_timer_create(&args, &timer);
+}
+
+/*
+ * Mirror the bond list into the controller's filter accept list.  The
+ * controller refuses changes while a filtered advertiser runs, so only
+ * call this while connected or before advertising starts.
+ */
+void adv_bonded(void)
+{
+	esp_ble_bond_dev_t list[8];
+	int i, n = LENGTH(list);
+
+	if (esp_ble_get_bond_device_list(&n, list) != ESP_OK) {
+		return;
+	}
+	esp_ble_gap_clear_whitelist();
+	for (i = 0; i < n; i++) {
+		esp_ble_gap_update_whitelist(true, list[i].bd_addr,
+			list[i].bd_addr_type == BLE_ADDR_TYPE_PUBLIC ? BLE_WL_ADDR_TYPE_PUBLIC : BLE_WL_ADDR_TYPE_RANDOM);
+	}
+	bonded = n;
+}
+
+// bda is the host to try first, or NULL to start at the accept list
+void adv_reconnect(const esp_bd_addr_t bda)
+{
+	static const esp_bd_addr_t none = { 0 };
+	esp_ble_bond_dev_t list[8];
+	int i, n = LENGTH(list);
+
+	esp_timer_stop(timer);
+	if (bda && memcmp(bda, none, sizeof(esp_bd_addr_t)) && esp_ble_get_bond_device_list(&n, list) == ESP_OK) {
+		for (i = 0; i < n; i++) {
+			if (!memcmp(list[i].bd_addr, bda, sizeof(esp_bd_addr_t))) {
+				memcpy(params.peer_addr, list[i].bd_addr, sizeof(esp_bd_addr_t));
+				params.peer_addr_type = list[i].bd_addr_type;
+				restart(ADV_DIRECT);
+				return;
+			}
+		}
+	}
+	restart(ADV_ACCEPT);
+}
+
+void adv_open(void)
+{
+	esp_timer_stop(timer);
+	if (phase != ADV_OPEN) {
+		restart(ADV_OPEN);
+	}
+}
+
+void adv_stopped(void)
+{
+	int p = atomic_exchange(&next, ADV_IDLE);
+
+	if (p != ADV_IDLE) {
+		start(p);
+	}
+}
+
+// returns the phase that got the connection
+int adv_connected(void)
+{
+	esp_timer_stop(timer);
+	next = ADV_IDLE;
+	return atomic_exchange(&phase, ADV_IDLE);
+}
+
+const char *adv_name(int p)
+{
+	return p >= 0 && p < LENGTH(names) ? names[p] : "?";
+}
@@ -0,0 +1,25 @@
+#include <stdint.h>
+#include "esp_err.h"
+#include "esp_gap_ble_api.h"
+
+/*
+ * Reconnect ladder: high duty directed advertising at the last host,
+ * then advertising only bonded hosts may connect to, then open.
+ */
+enum {
+	ADV_IDLE,
+	ADV_DIRECT,
+	ADV_ACCEPT,
+	ADV_OPEN,
+};
+
+#define ADV_DIRECT_US      1280000	// high duty directed is capped at 1.28 s
+#define ADV_ACCEPT_US    (10*1000*1000)
+
+esp_err_t adv_init(const esp_ble_adv_params_t *open);
+void adv_bonded(void);
+void adv_reconnect(const esp_bd_addr_t bda);
+void adv_open(void);
+void adv_stopped(void);
+int adv_connected(void);
+const char *adv_name(int phase);
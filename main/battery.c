@@ -0,0 +1,67 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include "battery.h"
+
+#define LENGTH(x)  ((int)(sizeof (x) / sizeof *(x)))
+
+// lithium polymer open circuit curve under a light load
+static const struct {
+	uint16_t mv;
+	uint8_t pct;
+} curve[] = {
+	{ 3300,   0 },
+	{ 3600,  10 },
+	{ 3700,  30 },
+	{ 3750,  45 },
+	{ 3800,  60 },
+	{ 3900,  75 },
+	{ 4000,  85 },
+	{ 4100,  95 },
+	{ 4200, 100 },
+};
+
+uint8_t battery_percent(uint16_t mv)
+{
+	int i;
+
+	if (mv <= curve[0].mv) {
+		return 0;
+	}
+	for (i = 1; i < LENGTH(curve); i++) {
+		if (mv < curve[i].mv) {
+			return curve[i-1].pct + (mv - curve[i-1].mv) * (curve[i].pct - curve[i-1].pct)
+				/ (curve[i].mv - curve[i-1].mv);
+		}
+	}
+	return 100;
+}
+
+/*
+ * Feed one frame's average reading, in calibrated mV at the pin.
+ * Returns true when level changed and the hosts should hear about it;
+ * radio bursts and the percent boundary itself would otherwise make it
+ * flicker.
+ */
+bool battery_add(Battery *b, uint16_t pin_mv)
+{
+	uint32_t mv = (uint32_t)pin_mv * BATTERY_DIVIDER;
+	uint8_t level;
+
+	if (!b->primed) {
+		b->acc = mv << BATTERY_SHIFT;
+		b->mv = mv;
+		b->level = battery_percent(mv);
+		b->primed = true;
+		return true;
+	}
+	b->acc = b->acc - (b->acc >> BATTERY_SHIFT) + mv;
+	mv = b->acc >> BATTERY_SHIFT;
+	level = battery_percent(mv);
+	if (level == b->level || abs((int)mv - b->mv) < BATTERY_HYST_MV) {
+		return false;
+	}
+	b->mv = mv;
+	b->level = level;
+	return true;
+}
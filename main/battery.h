@@ -0,0 +1,24 @@
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+ * The cell sits behind a 1:2 divider on GPIO7 (ADC1 channel 6).  It takes
+ * one slot in the continuous pattern for every BATTERY_DUTY rounds of the
+ * finger channels, so sensing keeps the ADC and pays about 5% of its
+ * samples for it.  Readings are converted with the ADC's eFuse curve
+ * fitting before they get here.
+ */
+#define BATTERY_DUTY                 3
+#define BATTERY_DIVIDER              2
+#define BATTERY_SHIFT                8	// filter weight 1/256 per frame
+#define BATTERY_HYST_MV             10	// the filtered voltage must move this far to report
+
+typedef struct {
+	uint32_t acc;	// filtered mV << BATTERY_SHIFT
+	uint16_t mv;	// filtered voltage behind level
+	uint8_t level;	// percent, what the hosts were last told
+	bool primed;
+} Battery;
+
+bool battery_add(Battery *b, uint16_t pin_mv);
+uint8_t battery_percent(uint16_t mv);
@@ -0,0 +1,56 @@
+#include <string.h>
+#include "bus.h"
+
+void bus_publish(Bus *b, const uint16_t *raw, int n, uint32_t us)
+{
+	uint32_t lock = atomic_load_explicit(&b->lock, memory_order_relaxed);
+
+	atomic_store_explicit(&b->lock, lock + 1, memory_order_relaxed);
+	atomic_thread_fence(memory_order_release);
+	b->frame.seq++;
+	b->frame.us = us;
+	memcpy(b->frame.raw, raw, sizeof(*raw) * (n < BUS_CHANNELS ? n : BUS_CHANNELS));
+	atomic_store_explicit(&b->lock, lock + 2, memory_order_release);
+}
+
+void bus_subscribe(Bus *b, Sub *s, const char *name)
+{
+	memset(s, 0, sizeof(*s));
+	s->bus = b;
+	s->name = name;
+	if (b->nsubs < BUS_SUBS_MAX) {
+		b->subs[b->nsubs++] = s;
+	}
+}
+
+bool bus_read(Sub *s, Frame *f)
+{
+	Bus *b = s->bus;
+	uint32_t before, after;
+	int i;
+
+	// give up rather than spin: the writer may be preempted mid-frame
+	for (i = 0;; i++) {
+		if (i >= BUS_RETRIES) {
+			return false;
+		}
+		if ((before = atomic_load_explicit(&b->lock, memory_order_acquire)) & 1) {
+			continue;
+		}
+		memcpy(f, (const void *)&b->frame, sizeof(*f));
+		atomic_thread_fence(memory_order_acquire);
+		after = atomic_load_explicit(&b->lock, memory_order_relaxed);
+		if (before == after) {
+			break;
+		}
+	}
+
+	if (f->seq == s->seq) {
+		return false;
+	}
+	if (s->seq && f->seq - s->seq > 1) {
+		s->dropped += f->seq - s->seq - 1;
+	}
+	s->seq = f->seq;
+	return true;
+}
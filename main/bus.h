@@ -0,0 +1,38 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+
+#define BUS_CHANNELS                 8
+#define BUS_SUBS_MAX                 4
+#define BUS_RETRIES                  4
+
+typedef struct {
+	uint32_t seq;
+	uint32_t us;
+	uint16_t raw[BUS_CHANNELS];
+} Frame;
+
+typedef struct Bus Bus;
+
+typedef struct {
+	Bus *bus;
+	const char *name;
+	uint32_t seq;		// last frame seen
+	uint32_t dropped;	// frames overwritten before they were read
+} Sub;
+
+/*
+ * Latest-value seqlock.  The producer bumps lock to odd, writes the frame
+ * and bumps it back to even; readers copy and retry if lock moved.  The
+ * producer never waits and each subscriber reads at its own rate.
+ */
+struct Bus {
+	_Atomic uint32_t lock;
+	Frame frame;
+	Sub *subs[BUS_SUBS_MAX];
+	int nsubs;
+};
+
+void bus_publish(Bus *b, const uint16_t *raw, int n, uint32_t us);
+void bus_subscribe(Bus *b, Sub *s, const char *name);
+bool bus_read(Sub *s, Frame *f);
@@ -0,0 +1,87 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include "esp_log.h"
+#include "esp_crc.h"
+#include "cfg.h"
+#include "keymap.h"
+#include "macro.h"
+#include "role.h"
+
+static const char *TAG = "cfg";
+
+static uint8_t buf[CFG_MAX_LEN];
+static uint16_t fill = 0;
+static uint8_t next = 0;
+static bool receiving = false;
+
+static uint8_t apply(const uint8_t *rec, uint16_t len)
+{
+	uint16_t n;
+	uint32_t crc;
+	esp_err_t ret;
+
+	if (len < CFG_HDR_LEN || rec[0] != CFG_MAGIC) {
+		return CFG_ELEN;
+	}
+	if (rec[1] != CFG_VERSION) {
+		return CFG_EVERSION;
+	}
+	n = rec[4] | rec[5] << 8;
+	crc = rec[6] | rec[7] << 8 | rec[8] << 16 | (uint32_t)rec[9] << 24;
+	if (n != len - CFG_HDR_LEN) {
+		return CFG_ELEN;
+	}
+	if (esp_crc32_le(esp_crc32_le(0, rec, 6), rec + CFG_HDR_LEN, n) != crc) {
+		return CFG_ECRC;
+	}
+
+	switch (rec[2]) {
+	case CFG_KEYMAP:
+		ret = keymap_store(rec + CFG_HDR_LEN, n);
+		break;
+	case CFG_MACROS:
+		ret = macro_store(rec + CFG_HDR_LEN, n);
+		break;
+	case CFG_ROLE:
+		ret = role_store(rec + CFG_HDR_LEN, n);
+		break;
+	default:
+		return CFG_ETYPE;
+	}
+	if (ret != ESP_OK) {
+		ESP_LOGE(TAG, "record %d rejected: %s", rec[2], esp_err_to_name(ret));
+		return CFG_EAPPLY;
+	}
+	ESP_LOGI(TAG, "applied record %d, %d bytes", rec[2], n);
+	return CFG_OK;
+}
+
+uint8_t cfg_write(const uint8_t *data, uint16_t len)
+{
+	if (len < 2) {
+		return CFG_ELEN;
+	}
+	if (data[1] & CFG_FIRST) {
+		receiving = true;
+		fill = 0;
+		next = data[0];
+	}
+	if (!receiving || data[0] != next) {
+		receiving = false;
+		return CFG_ESEQ;
+	}
+	if (fill + len - 2 > sizeof(buf)) {
+		receiving = false;
+		return CFG_ELEN;
+	}
+
+	memcpy(&buf[fill], data + 2, len - 2);
+	fill += len - 2;
+	next++;
+	if (!(data[1] & CFG_LAST)) {
+		return CFG_PENDING;
+	}
+	receiving = false;
+	return apply(buf, fill);
+}
@@ -0,0 +1,38 @@
+#include <stdint.h>
+#include "esp_err.h"
+
+/*
+ * Configuration upload over the vendor output report.  Every write is a
+ * chunk: <seq><flags><payload...>.  The reassembled payload is a record:
+ * <'K'><version><type><0><len:16><crc32:32><body...>, little endian, the
+ * CRC covering the first six header bytes and the body.
+ */
+#define CFG_MAGIC                  'K'
+#define CFG_VERSION                  1
+#define CFG_HDR_LEN                  10
+#define CFG_MAX_LEN             (CFG_HDR_LEN + 1024)
+
+enum {
+	CFG_FIRST = 1 << 0,
+	CFG_LAST  = 1 << 1,
+};
+
+enum {
+	CFG_KEYMAP = 1,
+	CFG_MACROS,
+	CFG_ROLE,
+};
+
+enum {
+	CFG_OK,
+	CFG_PENDING,
+	CFG_ESEQ,
+	CFG_ELEN,
+	CFG_EVERSION,
+	CFG_ECRC,
+	CFG_ETYPE,
+	CFG_EAPPLY,
+	CFG_EBUSY,	// chunk not taken, send it again
+};
+
+uint8_t cfg_write(const uint8_t *data, uint16_t len);
@@ -0,0 +1,243 @@
+#include <string.h>
+#include <stdatomic.h>
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_gap_ble_api.h"
+#include "conn.h"
+
+#define LENGTH(x)  ((int)(sizeof (x) / sizeof *(x)))
+
+static const char *TAG = "conn";
+
+static Link links[CONN_MAX];
+static esp_timer_handle_t idle_timer;
+static conn_kick_t kick;
+// the last input, from whichever task saw it, for the app task to pick up
+static _Atomic int64_t input, kicked;
+static _Atomic uint32_t input_conn = ~0u;
+// connect to first acked report, [0] hosts that used their cache, [1] rediscovered
+static uint32_t ready_sum[2], ready_n[2];
+
+static Link *by_bda(const esp_bd_addr_t bda)
+{
+	int i;
+
+	for (i = 0; i < LENGTH(links); i++) {
+		if (links[i].in_use && !memcmp(links[i].bda, bda, sizeof(esp_bd_addr_t))) {
+			return &links[i];
+		}
+	}
+	return NULL;
+}
+
+static Link *by_id(uint16_t conn_id)
+{
+	int i;
+
+	for (i = 0; i < LENGTH(links); i++) {
+		if (links[i].in_use && links[i].conn_id == conn_id) {
+			return &links[i];
+		}
+	}
+	return NULL;
+}
+
+static void request(Link *l, bool fast)
+{
+	esp_ble_conn_update_params_t p = {
+		.min_int = fast ? CONN_FAST_INTERVAL : CONN_IDLE_MIN,
+		.max_int = fast ? CONN_FAST_INTERVAL : CONN_IDLE_MAX,
+		.latency = fast ? 0 : CONN_IDLE_LATENCY,
+		.timeout = CONN_TIMEOUT,
+	};
+
+	memcpy(p.bda, l->bda, sizeof(esp_bd_addr_t));
+	if (esp_ble_gap_update_conn_params(&p) == ESP_OK) {
+		l->asked = esp_timer_get_time();
+	}
+}
+
+static void idle_check(void *arg)
+{
+	kick();
+}
+
+esp_err_t conn_init(conn_kick_t fn)
+{
+	esp_timer_create_args_t args = {
+		.callback = idle_check,
+		.dispatch_method = ESP_TIMER_TASK,
+		.name = "conn_idle",
+	};
+	esp_err_t ret;
+
+	kick = fn;
+	if ((ret = esp_timer_create(&args, &idle_timer)) != ESP_OK) {
+		return ret;
+	}
+	return esp_timer_start_periodic(idle_timer, CONN_IDLE_US/4);
+}
+
+/*
+ * Asks for the typing profile on links with recent input and relaxes the
+ * rest.  A request stays out until the host answers or CONN_ANSWER_US
+ * passes, so a refused one is asked again, but not on every key.
+ */
+void conn_service(void)
+{
+	int64_t now = esp_timer_get_time();
+	bool busy;
+	Link *l;
+	int i;
+
+	if ((l = by_id(atomic_load(&input_conn))) && atomic_load(&input) > l->input) {
+		l->input = atomic_load(&input);
+	}
+	for (i = 0; i < LENGTH(links); i++) {
+		l = &links[i];
+		busy = now - l->input <= CONN_IDLE_US;
+		if (!l->in_use || !l->secure || busy == l->fast || (l->asked && now - l->asked < CONN_ANSWER_US)) {
+			continue;
+		}
+		if (!busy) {
+			ESP_LOGI(TAG, "conn %d idle, relaxing interval", l->conn_id);
+		}
+		request(l, busy);
+	}
+}
+
+void conn_open(uint16_t conn_id, const esp_bd_addr_t bda, uint16_t interval, uint16_t latency, uint16_t timeout)
+{
+	int i;
+
+	for (i = 0; i < LENGTH(links) && links[i].in_use; i++);
+	if (i == LENGTH(links)) {
+		return;
+	}
+	memset(&links[i], 0, sizeof(Link));
+	links[i].in_use = true;
+	links[i].conn_id = conn_id;
+	memcpy(links[i].bda, bda, sizeof(esp_bd_addr_t));
+	links[i].interval = interval;
+	links[i].latency = latency;
+	links[i].timeout = timeout;
+	links[i].fast = interval < CONN_IDLE_MIN;
+	links[i].opened = esp_timer_get_time();
+	links[i].input = links[i].opened;
+	ESP_LOGI(TAG, "conn %d opened at %d.%02d ms, latency %d", conn_id, interval*125/100, interval*125%100, latency);
+}
+
+void conn_close(uint16_t conn_id)
+{
+	Link *l;
+
+	if ((l = by_id(conn_id))) {
+		l->in_use = false;
+	}
+}
+
+// ask for the typing profile once the link is encrypted
+void conn_secure(const esp_bd_addr_t bda)
+{
+	Link *l;
+
+	if ((l = by_bda(bda))) {
+		l->secure = true;
+		l->input = esp_timer_get_time();
+		conn_service();
+	}
+}
+
+void conn_updated(const esp_bd_addr_t bda, int status, uint16_t interval, uint16_t latency, uint16_t timeout)
+{
+	Link *l;
+
+	if (!(l = by_bda(bda))) {
+		return;
+	}
+	if (status != 0) {
+		// asked stays set, so the retry waits out CONN_ANSWER_US
+		l->refused++;
+		ESP_LOGI(TAG, "conn %d parameter update refused: %d", l->conn_id, status);
+		return;
+	}
+	// the host may pick its own parameters, what it applied decides
+	l->asked = 0;
+	l->fast = interval < CONN_IDLE_MIN;
+	l->interval = interval;
+	l->latency = latency;
+	l->timeout = timeout;
+	l->updates++;
+	ESP_LOGI(TAG, "conn %d now %d.%02d ms, latency %d, timeout %d ms", l->conn_id,
+		interval*125/100, interval*125%100, latency, timeout*10);
+}
+
+/*
+ * Called for every input, from any task.  Kicks the app task when the
+ * input moves to another link, and otherwise once per CONN_KICK_US, so a
+ * burst of typing costs it a few events.
+ */
+void conn_activity(uint16_t conn_id)
+{
+	int64_t now = esp_timer_get_time();
+
+	atomic_store(&input, now);
+	if (atomic_exchange(&input_conn, conn_id) != conn_id || now - atomic_load(&kicked) >= CONN_KICK_US) {
+		atomic_store(&kicked, now);
+		kick();
+	}
+}
+
+void conn_read(uint16_t conn_id, bool describes)
+{
+	Link *l;
+
+	if ((l = by_id(conn_id))) {
+		l->reads++;
+		l->described += describes;
+	}
+}
+
+// the first completed notification on a link means the host is set up
+void conn_ready(uint16_t conn_id)
+{
+	Link *l;
+	int rediscovered;
+
+	if (!(l = by_id(conn_id)) || l->ready_ms) {
+		return;
+	}
+	if ((l->ready_ms = (esp_timer_get_time() - l->opened)/1000) == 0) {
+		l->ready_ms = 1;
+	}
+	rediscovered = l->described != 0;
+	ready_sum[rediscovered] += l->ready_ms;
+	ready_n[rediscovered]++;
+	ESP_LOGI(TAG, "conn %d ready in %d ms, %s (%d reads, %d of the report map and references)",
+		conn_id, (int)l->ready_ms, rediscovered ? "rediscovered" : "gatt cache",
+		(int)l->reads, (int)l->described);
+}
+
+const Link *conn_get(uint16_t conn_id)
+{
+	return by_id(conn_id);
+}
+
+void conn_log(void)
+{
+	int i;
+
+	for (i = 0; i < LENGTH(links); i++) {
+		if (links[i].in_use) {
+			ESP_LOGI(TAG, "conn %d: %d.%02d ms, latency %d, %s, %d updates, %d refused",
+				links[i].conn_id, links[i].interval*125/100, links[i].interval*125%100,
+				links[i].latency, links[i].fast ? "fast" : "idle",
+				(int)links[i].updates, (int)links[i].refused);
+		}
+	}
+	if (ready_n[0] || ready_n[1]) {
+		ESP_LOGI(TAG, "ready after connect: %d ms cached (%d), %d ms rediscovered (%d)",
+			ready_n[0] ? (int)(ready_sum[0]/ready_n[0]) : 0, (int)ready_n[0],
+			ready_n[1] ? (int)(ready_sum[1]/ready_n[1]) : 0, (int)ready_n[1]);
+	}
+}
@@ -0,0 +1,56 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include "esp_err.h"
+#include "esp_bt_defs.h"
+
+#define CONN_MAX                     4	// CONFIG_BT_ACL_CONNECTIONS
+
+// intervals in 1.25 ms units, timeout in 10 ms units
+#define CONN_FAST_INTERVAL           6	// 7.5 ms, the BLE minimum
+#define CONN_IDLE_MIN               24	// 30 ms
+#define CONN_IDLE_MAX               40	// 50 ms
+#define CONN_IDLE_LATENCY            4
+#define CONN_TIMEOUT               400
+#define CONN_IDLE_US        (10*1000*1000)
+#define CONN_ANSWER_US      (2*1000*1000)	// before a request is asked again
+#define CONN_KICK_US        (1000*1000)	// input wakes the app task at most this often
+
+typedef struct {
+	bool in_use;
+	bool secure;
+	bool fast;		// the host applied the typing profile
+	int64_t asked;		// last parameter request, 0 once answered
+	int64_t input;		// last input the app task heard of
+	uint16_t conn_id;
+	esp_bd_addr_t bda;
+	// parameters the host actually applied
+	uint16_t interval;
+	uint16_t latency;
+	uint16_t timeout;
+	uint32_t updates;
+	uint32_t refused;
+	// reconnect cost: a host that has our database cached reads values
+	// but never the report map or report references
+	int64_t opened;
+	uint32_t ready_ms;
+	uint32_t reads;
+	uint32_t described;	// reads of the report map and references
+} Link;
+
+/*
+ * Links are only changed on the app task.  Input and the idle timer call
+ * kick, which should get conn_service run there.
+ */
+typedef void (*conn_kick_t)(void);
+
+esp_err_t conn_init(conn_kick_t kick);
+void conn_service(void);
+void conn_open(uint16_t conn_id, const esp_bd_addr_t bda, uint16_t interval, uint16_t latency, uint16_t timeout);
+void conn_close(uint16_t conn_id);
+void conn_secure(const esp_bd_addr_t bda);
+void conn_updated(const esp_bd_addr_t bda, int status, uint16_t interval, uint16_t latency, uint16_t timeout);
+void conn_activity(uint16_t conn_id);
+void conn_read(uint16_t conn_id, bool describes);
+void conn_ready(uint16_t conn_id);
+const Link *conn_get(uint16_t conn_id);
+void conn_log(void);
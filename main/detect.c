@@ -0,0 +1,72 @@
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include "detect.h"
+
+#define MIN(a, b)  ((a) > (b) ? (b) : (a))
+
+void detect_init(Detect *d, uint8_t base, uint16_t rows)
+{
+	memset(d, 0, sizeof(*d));
+	memset(d->min, ~0, sizeof(d->min));
+	memset(d->prev, ~0, sizeof(d->prev));
+	memset(d->sent, ~0, sizeof(d->sent));
+	d->base = base;
+	d->rows = rows;
+}
+
+// in place; a channel that has not moved yet keeps its raw value
+void detect_levels(Detect *d, uint16_t level[DETECT_CHANNELS])
+{
+	int i, n;
+
+	for (i = 0; i < DETECT_CHANNELS; i++) {
+		if (level[i] < d->min[i]) {
+			d->min[i] = level[i];
+		}
+		if (level[i] > d->max[i]) {
+			d->max[i] = level[i];
+		}
+		if (d->min[i] >= d->max[i]) {
+			continue;
+		}
+
+		n = level[i] - d->min[i];
+		if (i < DETECT_FINGERS) {
+			level[i] = MIN(DETECT_LEVELS-1, (sqrt(n)*sqrt(d->max[i]-d->min[i])*DETECT_LEVELS)/(d->max[i]-d->min[i]));
+		} else {
+			level[i] = MIN(d->rows-1, (n*d->rows)/(d->max[i]-d->min[i]));
+		}
+	}
+}
+
+void detect_fingers(Detect *d, const uint16_t level[DETECT_FINGERS], detect_emit_t emit)
+{
+	int i, k, n, match;
+
+	for (i = 0; i < DETECT_FINGERS; i++) {
+		n = level[i];
+		if (n < 2) {
+			d->sent[i] = ~0;
+			continue;
+		}
+		n = MIN(n-2, 4);
+		match = 1;
+		for (k = 0; k < DETECT_SETTLE; k++) {
+			if (d->prev[k][i] != n) {
+				match = 0;
+			}
+		}
+		d->prev[d->frame % DETECT_SETTLE][i] = n;
+		if (!match) {
+			continue;
+		}
+		if (d->sent[i] == n) {
+			d->sent[i] = ~0;
+			continue;
+		}
+		memset(d->prev, ~0, sizeof(d->prev));
+		emit(d->base + i*4 + n, i);
+	}
+	d->frame++;
+}
@@ -0,0 +1,28 @@
+#include <stdint.h>
+
+#define DETECT_FINGERS               4
+#define DETECT_CHANNELS              6	// the fingers, then the stick's two axes
+#define DETECT_LEVELS                6	// finger levels from rest to fully bent
+#define DETECT_SETTLE                8	// frames a finger holds a level before it counts
+
+/*
+ * Raw channel averages to levels and levels to keymap positions.  Every
+ * channel is scaled between the lowest and highest value it has shown.
+ * A finger past level 1 that holds a level for DETECT_SETTLE frames
+ * emits position base + finger*4 + level-2.  No platform calls, so
+ * recorded traces replay through it on a Linux host.
+ */
+typedef void (*detect_emit_t)(int idx, int ch);
+
+typedef struct {
+	uint16_t min[DETECT_CHANNELS], max[DETECT_CHANNELS];
+	uint16_t prev[DETECT_SETTLE][DETECT_FINGERS];
+	uint16_t sent[DETECT_FINGERS];
+	uint32_t frame;
+	uint8_t base;	// keymap index of this half's first finger position
+	uint16_t rows;	// levels along each stick axis
+} Detect;
+
+void detect_init(Detect *d, uint8_t base, uint16_t rows);
+void detect_levels(Detect *d, uint16_t level[DETECT_CHANNELS]);
+void detect_fingers(Detect *d, const uint16_t level[DETECT_FINGERS], detect_emit_t emit);
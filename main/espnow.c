@@ -0,0 +1,265 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_event.h"
+#include "esp_log.h"
+#include "esp_now.h"
+#include "esp_random.h"
+#include "esp_wifi.h"
+#include "mbedtls/ecdh.h"
+#include "mbedtls/ecp.h"
+#include "mbedtls/platform_util.h"
+#include "mbedtls/sha256.h"
+#include "nvs.h"
+#include "espnow.h"
+#include "split.h"
+
+#define PUBKEY_LEN                  32
+
+static const char *TAG = "espnow";
+
+typedef struct {
+	uint8_t peer[ESP_NOW_ETH_ALEN];
+	uint8_t pmk[ESP_NOW_KEY_LEN];
+	uint8_t lmk[ESP_NOW_KEY_LEN];
+} Link;
+
+static const uint8_t broadcast[ESP_NOW_ETH_ALEN] = { 0xff, 0xff, 0xff, 0xff, 0xff, 0xff };
+static espnow_recv_t handler;
+static Link link;
+static _Atomic bool ready;	// the radio is up
+static _Atomic bool paired;	// link is filled in and its peer added
+
+// the first announcement heard while pairing
+static _Atomic bool announcing, heard;
+static uint8_t heard_mac[ESP_NOW_ETH_ALEN];
+static uint8_t heard_key[PUBKEY_LEN];
+
+static void recv(const esp_now_recv_info_t *info, const uint8_t *data, int len)
+{
+	if (atomic_load(&announcing) && len == 1 + PUBKEY_LEN && data[0] == ESPNOW_PAIR_MAGIC) {
+		if (!atomic_load(&heard)) {
+			memcpy(heard_mac, info->src_addr, ESP_NOW_ETH_ALEN);
+			memcpy(heard_key, data + 1, PUBKEY_LEN);
+			atomic_store(&heard, true);
+		}
+		return;
+	}
+	if (!atomic_load(&paired) || memcmp(info->src_addr, link.peer, ESP_NOW_ETH_ALEN)) {
+		return;
+	}
+	if (len > 0 && len <= ESPNOW_FRAME_MAX) {
+		handler(data, len);
+	}
+}
+
+static int send(Transport *t, const uint8_t *frame, size_t len)
+{
+	if (!atomic_load(&paired)) {
+		return ESP_ERR_ESPNOW_NOT_FOUND;
+	}
+	return esp_now_send(link.peer, frame, len);
+}
+
+static int rng(void *ctx, unsigned char *buf, size_t len)
+{
+	esp_fill_random(buf, len);
+	return 0;
+}
+
+static esp_err_t load(void)
+{
+	nvs_handle_t nvs;
+	size_t len = sizeof(link);
+	esp_err_t ret;
+
+	if ((ret = nvs_open("lask", NVS_READONLY, &nvs)) != ESP_OK) {
+		return ret;
+	}
+	if ((ret = nvs_get_blob(nvs, "link", &link, &len)) == ESP_OK && len != sizeof(link)) {
+		ret = ESP_ERR_INVALID_SIZE;
+	}
+	nvs_close(nvs);
+	return ret;
+}
+
+static esp_err_t store(void)
+{
+	nvs_handle_t nvs;
+	esp_err_t ret;
+
+	if ((ret = nvs_open("lask", NVS_READWRITE, &nvs)) != ESP_OK) {
+		return ret;
+	}
+	if ((ret = nvs_set_blob(nvs, "link", &link, sizeof(link))) == ESP_OK) {
+		ret = nvs_commit(nvs);
+	}
+	nvs_close(nvs);
+	return ret;
+}
+
+static esp_err_t join(void)
+{
+	esp_now_peer_info_t peer = {
+		.channel = ESPNOW_CHANNEL,
+		.ifidx = WIFI_IF_STA,
+		.encrypt = true,
+	};
+	esp_err_t ret;
+
+	memcpy(peer.peer_addr, link.peer, ESP_NOW_ETH_ALEN);
+	memcpy(peer.lmk, link.lmk, ESP_NOW_KEY_LEN);
+	if ((ret = esp_now_set_pmk(link.pmk)) != ESP_OK ||
+	    (ret = esp_now_add_peer(&peer)) != ESP_OK) {
+		return ret;
+	}
+	mbedtls_platform_zeroize(&peer, sizeof(peer));
+	atomic_store(&paired, true);
+	ESP_LOGI(TAG, "peer %02x:%02x:%02x:%02x:%02x:%02x", link.peer[0], link.peer[1],
+	         link.peer[2], link.peer[3], link.peer[4], link.peer[5]);
+	return ESP_OK;
+}
+
+// both halves hash the same X25519 secret into the same pmk and lmk
+static int derive(mbedtls_ecp_group *grp, const mbedtls_mpi *d)
+{
+	mbedtls_ecp_point theirs;
+	mbedtls_mpi z;
+	uint8_t secret[PUBKEY_LEN], hash[32];
+	int ret;
+
+	mbedtls_ecp_point_init(&theirs);
+	mbedtls_mpi_init(&z);
+	if ((ret = mbedtls_ecp_point_read_binary(grp, &theirs, heard_key, PUBKEY_LEN)) == 0 &&
+	    (ret = mbedtls_ecdh_compute_shared(grp, &z, &theirs, d, rng, NULL)) == 0 &&
+	    (ret = mbedtls_mpi_write_binary(&z, secret, sizeof(secret))) == 0 &&
+	    (ret = mbedtls_sha256(secret, sizeof(secret), hash, 0)) == 0) {
+		memcpy(link.peer, heard_mac, ESP_NOW_ETH_ALEN);
+		memcpy(link.pmk, hash, ESP_NOW_KEY_LEN);
+		memcpy(link.lmk, hash + ESP_NOW_KEY_LEN, ESP_NOW_KEY_LEN);
+	}
+	mbedtls_platform_zeroize(secret, sizeof(secret));
+	mbedtls_platform_zeroize(hash, sizeof(hash));
+	mbedtls_mpi_free(&z);
+	mbedtls_ecp_point_free(&theirs);
+	return ret;
+}
+
+/*
+ * Announce a fresh public key by broadcast until the other half's is
+ * heard, then a little longer so it hears ours.  Whoever announces first
+ * in the window is taken, like Just Works pairing over BLE.
+ */
+static esp_err_t pair(void)
+{
+	esp_now_peer_info_t peer = {
+		.channel = ESPNOW_CHANNEL,
+		.ifidx = WIFI_IF_STA,
+		.encrypt = false,
+	};
+	mbedtls_ecp_group grp;
+	mbedtls_ecp_point q;
+	mbedtls_mpi d;
+	uint8_t hello[1+PUBKEY_LEN] = { ESPNOW_PAIR_MAGIC };
+	size_t n;
+	int left, ret;
+	esp_err_t err;
+
+	memcpy(peer.peer_addr, broadcast, sizeof(broadcast));
+	if ((err = esp_now_add_peer(&peer)) != ESP_OK) {
+		return err;
+	}
+	mbedtls_ecp_group_init(&grp);
+	mbedtls_ecp_point_init(&q);
+	mbedtls_mpi_init(&d);
+	if ((ret = mbedtls_ecp_group_load(&grp, MBEDTLS_ECP_DP_CURVE25519)) != 0 ||
+	    (ret = mbedtls_ecp_gen_keypair(&grp, &d, &q, rng, NULL)) != 0 ||
+	    (ret = mbedtls_ecp_point_write_binary(&grp, &q, MBEDTLS_ECP_PF_UNCOMPRESSED, &n, hello + 1, PUBKEY_LEN)) != 0) {
+		ESP_LOGE(TAG, "pairing key: -0x%x", -ret);
+		err = ESP_FAIL;
+		goto out;
+	}
+	ESP_LOGI(TAG, "pairing for %d s, do the same on the other half", ESPNOW_PAIR_MS / 1000);
+	atomic_store(&announcing, true);
+	err = ESP_ERR_TIMEOUT;
+	for (left = ESPNOW_PAIR_MS; left > 0; left -= ESPNOW_PAIR_EVERY_MS) {
+		esp_now_send(broadcast, hello, sizeof(hello));
+		vTaskDelay(pdMS_TO_TICKS(ESPNOW_PAIR_EVERY_MS));
+		if (err != ESP_ERR_TIMEOUT || !atomic_load(&heard)) {
+			continue;
+		}
+		if ((ret = derive(&grp, &d)) != 0) {
+			ESP_LOGE(TAG, "pairing secret: -0x%x", -ret);
+			err = ESP_FAIL;
+			break;
+		}
+		err = store();
+		left = left < ESPNOW_PAIR_LINGER_MS ? left : ESPNOW_PAIR_LINGER_MS;
+	}
+	atomic_store(&announcing, false);
+out:
+	mbedtls_mpi_free(&d);
+	mbedtls_ecp_point_free(&q);
+	mbedtls_ecp_group_free(&grp);
+	esp_now_del_peer(broadcast);
+	return err;
+}
+
+/*
+ * The old peer is dropped for the window, so the link is down while
+ * pairing and comes back with the new one, or not at all if none is heard.
+ */
+esp_err_t espnow_pair(void)
+{
+	esp_err_t ret;
+
+	if (!atomic_load(&ready)) {
+		return ESP_ERR_INVALID_STATE;
+	}
+	if (atomic_exchange(&paired, false)) {
+		esp_now_del_peer(link.peer);
+	}
+	if ((ret = pair()) != ESP_OK) {
+		return ret;
+	}
+	return join();
+}
+
+/*
+ * Station mode on a fixed channel with nothing to associate to; the
+ * radio is shared with Bluetooth through the coexistence scheduler.
+ * Without a stored peer the link stays down until the halves are paired.
+ */
+esp_err_t espnow_init(Transport *t, espnow_recv_t fn)
+{
+	wifi_init_config_t cfg = WIFI_INIT_CONFIG_DEFAULT();
+	esp_err_t ret;
+
+	if ((ret = esp_event_loop_create_default()) != ESP_OK && ret != ESP_ERR_INVALID_STATE) {
+		return ret;
+	}
+	if ((ret = esp_wifi_init(&cfg)) != ESP_OK ||
+	    (ret = esp_wifi_set_storage(WIFI_STORAGE_RAM)) != ESP_OK ||
+	    (ret = esp_wifi_set_mode(WIFI_MODE_STA)) != ESP_OK ||
+	    (ret = esp_wifi_start()) != ESP_OK ||
+	    (ret = esp_wifi_set_channel(ESPNOW_CHANNEL, WIFI_SECOND_CHAN_NONE)) != ESP_OK) {
+		ESP_LOGE(TAG, "wifi: %s", esp_err_to_name(ret));
+		return ret;
+	}
+	handler = fn;
+	if ((ret = esp_now_init()) != ESP_OK ||
+	    (ret = esp_now_register_recv_cb(recv)) != ESP_OK) {
+		return ret;
+	}
+	t->send = send;
+	t->ctx = NULL;
+	atomic_store(&ready, true);
+	if (load() != ESP_OK) {
+		ESP_LOGW(TAG, "not paired");
+		return ESP_OK;
+	}
+	return join();
+}
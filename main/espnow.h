@@ -0,0 +1,27 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include "esp_err.h"
+
+/*
+ * The halves talk only to the peer they paired with, encrypted with keys
+ * agreed over X25519 and kept in nvs.  espnow_pair opens a window in
+ * which the first half heard announcing is taken, so it has to be
+ * opened on both halves within ESPNOW_PAIR_MS of each other; pairing
+ * again replaces the peer.
+ */
+#define ESPNOW_CHANNEL               1
+#define ESPNOW_FRAME_MAX            40	// at least SPLIT_FRAME_MAX
+#define ESPNOW_PAIR_MAGIC         0x50
+#define ESPNOW_PAIR_MS           15000	// window to open pairing on the other half in
+#define ESPNOW_PAIR_LINGER_MS     1000	// keep announcing once paired, for the other half to hear
+#define ESPNOW_PAIR_EVERY_MS       100
+
+struct Transport;
+
+// runs on the Wi-Fi task
+typedef void (*espnow_recv_t)(const uint8_t *frame, int len);
+
+// up without a peer until the halves are paired
+esp_err_t espnow_init(struct Transport *t, espnow_recv_t recv);
+// blocks for up to ESPNOW_PAIR_MS
+esp_err_t espnow_pair(void);
@@ -0,0 +1,127 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include "gesture.h"
+
+// sweeps index to pinky and back, each fires keymap entry KEYMAP_GESTURE + its place
+const Template gesture_templates[GESTURE_TEMPLATES] = {
+	{ 4, { 0, 1, 2, 3 } },
+	{ 4, { 3, 2, 1, 0 } },
+};
+
+void gesture_init(Gestures *g, const Template *t, Matcher *m, int n, gesture_emit_t emit)
+{
+	memset(g, 0, sizeof(*g));
+	g->t = t;
+	g->m = m;
+	g->n = n;
+	g->emit = emit;
+	memset(m, 0, sizeof(*m)*n);
+}
+
+static void reset(Gestures *g)
+{
+	int i;
+
+	for (i = 0; i < g->n; i++) {
+		g->m[i].pos = 0;
+	}
+}
+
+// true while some template has started and its next finger may still come
+static bool pending(const Gestures *g, uint32_t us)
+{
+	int i;
+
+	for (i = 0; i < g->n; i++) {
+		if (g->m[i].pos && us - g->m[i].last <= GESTURE_STEP_US) {
+			return true;
+		}
+	}
+	return false;
+}
+
+static void flush(Gestures *g)
+{
+	int i;
+
+	for (i = 0; i < g->nheld; i++) {
+		g->emit(g->held[i].idx, g->held[i].ch);
+	}
+	g->nheld = 0;
+}
+
+static int advance(const Template *t, Matcher *m, int finger, uint32_t us)
+{
+	// a finger in the same frame as the last one does not follow it
+	if (m->pos && (us - m->last > GESTURE_STEP_US || us == m->last)) {
+		m->pos = 0;
+	}
+	if (t->seq[m->pos] != finger) {
+		// a wrong finger may still start the template over
+		m->pos = 0;
+		if (t->seq[0] != finger) {
+			return 0;
+		}
+	}
+	if (m->pos == 0) {
+		m->start = us;
+	}
+	m->last = us;
+	if (++m->pos < t->len) {
+		return 0;
+	}
+	m->pos = 0;
+	return us - m->start <= GESTURE_MAX_US;
+}
+
+/*
+ * One frame of finger levels.  Returns the template that completed, or
+ * -1.  Fingers landing on the same frame are taken index first.
+ */
+int gesture_step(Gestures *g, const uint16_t level[GESTURE_FINGERS], uint32_t us)
+{
+	uint8_t down = 0, onset;
+	int f, i;
+
+	for (f = 0; f < GESTURE_FINGERS; f++) {
+		down |= (level[f] >= GESTURE_PRESS) << f;
+	}
+	onset = down & ~g->down;
+	g->down = down;
+	g->spent &= down;
+
+	for (f = 0; onset; f++, onset >>= 1) {
+		if (!(onset & 1)) {
+			continue;
+		}
+		for (i = 0; i < g->n; i++) {
+			if (advance(&g->t[i], &g->m[i], f, us)) {
+				reset(g);
+				g->nheld = 0;
+				g->spent = down;
+				return i;
+			}
+		}
+	}
+	if (!pending(g, us)) {
+		flush(g);
+	}
+	return -1;
+}
+
+// a settled finger position, passed on once no template is waiting on it
+void gesture_tap(Gestures *g, int idx, int ch, uint32_t us)
+{
+	if (ch < GESTURE_FINGERS && g->spent & 1 << ch) {
+		return;
+	}
+	if (pending(g, us) && g->nheld < GESTURE_HELD) {
+		g->held[g->nheld].idx = idx;
+		g->held[g->nheld].ch = ch;
+		g->nheld++;
+		return;
+	}
+	flush(g);
+	g->emit(idx, ch);
+}
@@ -0,0 +1,54 @@
+#include <stdint.h>
+
+#define GESTURE_FINGERS              4
+#define GESTURE_LEN                  4	// longest template
+#define GESTURE_PRESS                2	// finger level that counts as down
+#define GESTURE_STEP_US         120000	// most between two fingers of one gesture
+#define GESTURE_MAX_US          400000	// most for the whole gesture
+#define GESTURE_BUDGET_CYCLES     4000	// per frame, about 17 us at 240 MHz, see host/bench_gesture
+#define GESTURE_HELD                 8	// finger taps waiting on a template
+#define GESTURE_TEMPLATES            2
+
+/*
+ * Rolls across the finger channels.  Every template keeps one matcher
+ * that advances on finger onsets, each strictly later than the one
+ * before, so fingers landing together are no roll.  A frame costs a
+ * compare per template whatever the history, and memory does not grow
+ * with it.  Templates are tried longest first and a match resets them
+ * all, so a shorter template that ends the same way never fires on the
+ * same roll.
+ *
+ * Finger taps go through gesture_tap, which holds them back while a
+ * template can still match.  A match drops them, and the fingers that
+ * are down stay spent until they lift, so a roll types only its gesture.
+ */
+typedef struct {
+	uint8_t len;
+	uint8_t seq[GESTURE_LEN];	// finger channels in onset order
+} Template;
+
+typedef struct {
+	uint8_t pos;	// fingers matched so far
+	uint32_t start, last;
+} Matcher;
+
+typedef void (*gesture_emit_t)(int idx, int ch);
+
+typedef struct {
+	const Template *t;
+	int n;
+	Matcher *m;
+	uint8_t down;	// finger bits past GESTURE_PRESS last frame
+	uint8_t spent;	// fingers of the last match, not lifted since
+	gesture_emit_t emit;
+	struct {
+		uint8_t idx, ch;
+	} held[GESTURE_HELD];
+	int nheld;
+} Gestures;
+
+extern const Template gesture_templates[GESTURE_TEMPLATES];
+
+void gesture_init(Gestures *g, const Template *t, Matcher *m, int n, gesture_emit_t emit);
+int gesture_step(Gestures *g, const uint16_t level[GESTURE_FINGERS], uint32_t us);
+void gesture_tap(Gestures *g, int idx, int ch, uint32_t us);
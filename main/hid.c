@@ -5,18 +5,19 @@
 #include <stdio.h>
 #include "esp_log.h"
 #include "hid.h"
+#include "usage.h"
 
 // HID keyboard input report length
-#define HID_KEYBOARD_IN_RPT_LEN     8
+#define HID_KEYBOARD_IN_RPT_LEN     HID_RPT_LEN_KEY_IN
 
 // HID LED output report length
-#define HID_LED_OUT_RPT_LEN         1
+#define HID_LED_OUT_RPT_LEN         HID_RPT_LEN_LED_OUT
 
 // HID mouse input report length
-#define HID_MOUSE_IN_RPT_LEN        5
+#define HID_MOUSE_IN_RPT_LEN        HID_RPT_LEN_MOUSE_IN
 
 // HID consumer control input report length
-#define HID_CC_IN_RPT_LEN           2
+#define HID_CC_IN_RPT_LEN           HID_RPT_LEN_CC_IN
 
 #define HI_UINT16(a) (((a) >> 8) & 0xFF)
 #define LO_UINT16(a) ((a) & 0xFF)
@@ -36,159 +37,210 @@ struct prf_char_pres_fmt {
 
 // HID report mapping table
 static hid_report_map_t hid_rpt_map[HID_NUM_REPORTS];
+// the same reports indexed by [mode][type][id], so sending never searches
+static hid_report_map_t *hid_rpt_idx[2][HID_REPORT_TYPE_FEATURE + 1][HID_RPT_ID_NB];
+
+// HID Report Map characteristic value, one section per entry in HID_REPORTS
+#define HID_DESC_MOUSE_IN(id) \
+	0x05, 0x01,		/* Usage Page (Generic Desktop) */ \
+	0x09, 0x02,		/* Usage (Mouse) */ \
+	0xA1, 0x01,		/* Collection (Application) */ \
+	0x85, id,		/* Report Id */ \
+	0x09, 0x01,		/*   Usage (Pointer) */ \
+	0xA1, 0x00,		/*   Collection (Physical) */ \
+	0x05, 0x09,		/*     Usage Page (Buttons) */ \
+	0x19, 0x01,		/*     Usage Minimum (01) - Button 1 */ \
+	0x29, 0x03,		/*     Usage Maximum (03) - Button 3 */ \
+	0x15, 0x00,		/*     Logical Minimum (0) */ \
+	0x25, 0x01,		/*     Logical Maximum (1) */ \
+	0x75, 0x01,		/*     Report Size (1) */ \
+	0x95, 0x03,		/*     Report Count (3) */ \
+	0x81, 0x02,		/*     Input (Data, Variable, Absolute) - Button states */ \
+	0x75, 0x05,		/*     Report Size (5) */ \
+	0x95, 0x01,		/*     Report Count (1) */ \
+	0x81, 0x01,		/*     Input (Constant) - Padding or Reserved bits */ \
+	0x05, 0x01,		/*     Usage Page (Generic Desktop) */ \
+	0x09, 0x30,		/*     Usage (X) */ \
+	0x09, 0x31,		/*     Usage (Y) */ \
+	0x15, 0x81,		/*     Logical Minimum (-127) */ \
+	0x25, 0x7F,		/*     Logical Maximum (127) */ \
+	0x75, 0x08,		/*     Report Size (8) */ \
+	0x95, 0x02,		/*     Report Count (2) */ \
+	0x81, 0x06,		/*     Input (Data, Variable, Relative) - X & Y coordinate */ \
+	0xA1, 0x02,		/*     Collection (Logical) */ \
+	0x09, 0x48,		/*       Usage (Resolution Multiplier) */ \
+	0x15, 0x00,		/*       Logical Minimum (0) */ \
+	0x25, 0x01,		/*       Logical Maximum (1) */ \
+	0x35, 0x01,		/*       Physical Minimum (1) */ \
+	0x45, HID_RES_MULT,	/*       Physical Maximum */ \
+	0x75, 0x02,		/*       Report Size (2) */ \
+	0x95, 0x01,		/*       Report Count (1) */ \
+	0xB1, 0x02,		/*       Feature (Data, Variable, Absolute) */ \
+	0x35, 0x00,		/*       Physical Minimum (0) */ \
+	0x45, 0x00,		/*       Physical Maximum (0) */ \
+	0x09, 0x38,		/*       Usage (Wheel) */ \
+	0x15, 0x81,		/*       Logical Minimum (-127) */ \
+	0x25, 0x7F,		/*       Logical Maximum (127) */ \
+	0x75, 0x08,		/*       Report Size (8) */ \
+	0x81, 0x06,		/*       Input (Data, Variable, Relative) - Wheel */ \
+	0xC0,			/*     End Collection */ \
+	0xA1, 0x02,		/*     Collection (Logical) */ \
+	0x09, 0x48,		/*       Usage (Resolution Multiplier) */ \
+	0x15, 0x00,		/*       Logical Minimum (0) */ \
+	0x25, 0x01,		/*       Logical Maximum (1) */ \
+	0x35, 0x01,		/*       Physical Minimum (1) */ \
+	0x45, HID_RES_MULT,	/*       Physical Maximum */ \
+	0x75, 0x02,		/*       Report Size (2) */ \
+	0xB1, 0x02,		/*       Feature (Data, Variable, Absolute) */ \
+	0x35, 0x00,		/*       Physical Minimum (0) */ \
+	0x45, 0x00,		/*       Physical Maximum (0) */ \
+	0x05, 0x0C,		/*       Usage Page (Consumer) */ \
+	0x0A, 0x38, 0x02,	/*       Usage (AC Pan) */ \
+	0x15, 0x81,		/*       Logical Minimum (-127) */ \
+	0x25, 0x7F,		/*       Logical Maximum (127) */ \
+	0x75, 0x08,		/*       Report Size (8) */ \
+	0x81, 0x06,		/*       Input (Data, Variable, Relative) - AC Pan */ \
+	0xC0,			/*     End Collection */ \
+	0x75, 0x04,		/*     Report Size (4) */ \
+	0xB1, 0x03,		/*     Feature (Constant) - Padding */ \
+	0xC0,			/*   End Collection */ \
+	0xC0,			/* End Collection */
+
+#define HID_DESC_KEY_IN(id) \
+	0x05, 0x01,		/* Usage Pg (Generic Desktop) */ \
+	0x09, 0x06,		/* Usage (Keyboard) */ \
+	0xA1, 0x01,		/* Collection: (Application) */ \
+	0x85, id,		/* Report Id */ \
+	0x05, 0x07,		/*   Usage Pg (Key Codes) */ \
+	0x19, 0xE0,		/*   Usage Min (224) */ \
+	0x29, 0xE7,		/*   Usage Max (231) */ \
+	0x15, 0x00,		/*   Log Min (0) */ \
+	0x25, 0x01,		/*   Log Max (1) */ \
+	/*   Modifier byte */ \
+	0x75, 0x01,		/*   Report Size (1) */ \
+	0x95, 0x08,		/*   Report Count (8) */ \
+	0x81, 0x02,		/*   Input: (Data, Variable, Absolute) */ \
+	/*   Reserved byte */ \
+	0x95, 0x01,		/*   Report Count (1) */ \
+	0x75, 0x08,		/*   Report Size (8) */ \
+	0x81, 0x01,		/*   Input: (Constant) */ \
+	/*   LED report */ \
+	0x05, 0x08,		/*   Usage Pg (LEDs) */ \
+	0x19, 0x01,		/*   Usage Min (1) */ \
+	0x29, 0x05,		/*   Usage Max (5) */ \
+	0x95, 0x05,		/*   Report Count (5) */ \
+	0x75, 0x01,		/*   Report Size (1) */ \
+	0x91, 0x02,		/*   Output: (Data, Variable, Absolute) */ \
+	/*   LED report padding */ \
+	0x95, 0x01,		/*   Report Count (1) */ \
+	0x75, 0x03,		/*   Report Size (3) */ \
+	0x91, 0x01,		/*   Output: (Constant) */ \
+	/*   Key arrays (6 bytes) */ \
+	0x95, 0x06,		/*   Report Count (6) */ \
+	0x75, 0x08,		/*   Report Size (8) */ \
+	0x15, 0x00,		/*   Log Min (0) */ \
+	0x25, 0x65,		/*   Log Max (101) */ \
+	0x05, 0x07,		/*   Usage Pg (Key Codes) */ \
+	0x19, 0x00,		/*   Usage Min (0) */ \
+	0x29, 0x65,		/*   Usage Max (101) */ \
+	0x81, 0x00,		/*   Input: (Data, Array) */ \
+	0xC0,			/* End Collection */
+
+// the LED bits are part of the keyboard collection
+#define HID_DESC_LED_OUT(id)
+
+#define HID_DESC_CC_IN(id) \
+	0x05, 0x0C,		/* Usage Pg (Consumer Devices) */ \
+	0x09, 0x01,		/* Usage (Consumer Control) */ \
+	0xA1, 0x01,		/* Collection (Application) */ \
+	0x85, id,		/* Report Id */ \
+	0x09, 0x02,		/*   Usage (Numeric Key Pad) */ \
+	0xA1, 0x02,		/*   Collection (Logical) */ \
+	0x05, 0x09,		/*     Usage Pg (Button) */ \
+	0x19, 0x01,		/*     Usage Min (Button 1) */ \
+	0x29, 0x0A,		/*     Usage Max (Button 10) */ \
+	0x15, 0x01,		/*     Logical Min (1) */ \
+	0x25, 0x0A,		/*     Logical Max (10) */ \
+	0x75, 0x04,		/*     Report Size (4) */ \
+	0x95, 0x01,		/*     Report Count (1) */ \
+	0x81, 0x00,		/*     Input (Data, Ary, Abs) */ \
+	0xC0,			/*   End Collection */ \
+	0x05, 0x0C,		/*   Usage Pg (Consumer Devices) */ \
+	0x09, 0x86,		/*   Usage (Channel) */ \
+	0x15, 0xFF,		/*   Logical Min (-1) */ \
+	0x25, 0x01,		/*   Logical Max (1) */ \
+	0x75, 0x02,		/*   Report Size (2) */ \
+	0x95, 0x01,		/*   Report Count (1) */ \
+	0x81, 0x46,		/*   Input (Data, Var, Rel, Null) */ \
+	0x09, 0xE9,		/*   Usage (Volume Up) */ \
+	0x09, 0xEA,		/*   Usage (Volume Down) */ \
+	0x15, 0x00,		/*   Logical Min (0) */ \
+	0x75, 0x01,		/*   Report Size (1) */ \
+	0x95, 0x02,		/*   Report Count (2) */ \
+	0x81, 0x02,		/*   Input (Data, Var, Abs) */ \
+	0x09, 0xE2,		/*   Usage (Mute) */ \
+	0x09, 0x30,		/*   Usage (Power) */ \
+	0x09, 0x83,		/*   Usage (Recall Last) */ \
+	0x09, 0x81,		/*   Usage (Assign Selection) */ \
+	0x09, 0xB0,		/*   Usage (Play) */ \
+	0x09, 0xB1,		/*   Usage (Pause) */ \
+	0x09, 0xB2,		/*   Usage (Record) */ \
+	0x09, 0xB3,		/*   Usage (Fast Forward) */ \
+	0x09, 0xB4,		/*   Usage (Rewind) */ \
+	0x09, 0xB5,		/*   Usage (Scan Next) */ \
+	0x09, 0xB6,		/*   Usage (Scan Prev) */ \
+	0x09, 0xB7,		/*   Usage (Stop) */ \
+	0x15, 0x01,		/*   Logical Min (1) */ \
+	0x25, 0x0C,		/*   Logical Max (12) */ \
+	0x75, 0x04,		/*   Report Size (4) */ \
+	0x95, 0x01,		/*   Report Count (1) */ \
+	0x81, 0x00,		/*   Input (Data, Ary, Abs) */ \
+	0x09, 0x80,		/*   Usage (Selection) */ \
+	0xA1, 0x02,		/*   Collection (Logical) */ \
+	0x05, 0x09,		/*     Usage Pg (Button) */ \
+	0x19, 0x01,		/*     Usage Min (Button 1) */ \
+	0x29, 0x03,		/*     Usage Max (Button 3) */ \
+	0x15, 0x01,		/*     Logical Min (1) */ \
+	0x25, 0x03,		/*     Logical Max (3) */ \
+	0x75, 0x02,		/*     Report Size (2) */ \
+	0x81, 0x00,		/*     Input (Data, Ary, Abs) */ \
+	0xC0,			/*   End Collection */ \
+	0x81, 0x03,		/*   Input (Const, Var, Abs) */ \
+	0xC0,			/* End Collection */
+
+// the resolution multipliers live in the mouse collection
+#define HID_DESC_MOUSE_FEAT(id)
+
+#define HID_DESC_VENDOR_OUT(id) \
+	0x06, 0xFF, 0xFF,	/* Usage Page(Vendor defined) */ \
+	0x09, 0xA5,		/* Usage(Vendor Defined) */ \
+	0xA1, 0x01,		/* Collection(Application) */ \
+	0x85, id,		/* Report Id */ \
+	0x09, 0xA6,		/* Usage(Vendor defined) */ \
+	0x09, 0xA9,		/* Usage(Vendor defined) */ \
+	0x75, 0x08,		/* Report Size */ \
+	0x95, 0x7F,		/* Report Count = 127 Btyes */ \
+	0x91, 0x02,		/* Output(Data, Variable, Absolute) */ \
+	0xC0,			/* End Collection */
+
+#define HID_DESC(name, id, type, len) HID_DESC_##name(id)
 
-// HID Report Map characteristic value
-// Keyboard report descriptor (using format for Boot interface descriptor)
 static const uint8_t hidReportMap[] = {
-	0x05, 0x01,		// Usage Page (Generic Desktop)
-	0x09, 0x02,		// Usage (Mouse)
-	0xA1, 0x01,		// Collection (Application)
-	0x85, 0x01,		// Report Id (1)
-	0x09, 0x01,		//   Usage (Pointer)
-	0xA1, 0x00,		//   Collection (Physical)
-	0x05, 0x09,		//     Usage Page (Buttons)
-	0x19, 0x01,		//     Usage Minimum (01) - Button 1
-	0x29, 0x03,		//     Usage Maximum (03) - Button 3
-	0x15, 0x00,		//     Logical Minimum (0)
-	0x25, 0x01,		//     Logical Maximum (1)
-	0x75, 0x01,		//     Report Size (1)
-	0x95, 0x03,		//     Report Count (3)
-	0x81, 0x02,		//     Input (Data, Variable, Absolute) - Button states
-	0x75, 0x05,		//     Report Size (5)
-	0x95, 0x01,		//     Report Count (1)
-	0x81, 0x01,		//     Input (Constant) - Padding or Reserved bits
-	0x05, 0x01,		//     Usage Page (Generic Desktop)
-	0x09, 0x30,		//     Usage (X)
-	0x09, 0x31,		//     Usage (Y)
-	0x09, 0x38,		//     Usage (Wheel)
-	0x15, 0x81,		//     Logical Minimum (-127)
-	0x25, 0x7F,		//     Logical Maximum (127)
-	0x75, 0x08,		//     Report Size (8)
-	0x95, 0x03,		//     Report Count (3)
-	0x81, 0x06,		//     Input (Data, Variable, Relative) - X & Y coordinate
-	0xC0,			//   End Collection
-	0xC0,			// End Collection
-
-	0x05, 0x01,		// Usage Pg (Generic Desktop)
-	0x09, 0x06,		// Usage (Keyboard)
-	0xA1, 0x01,		// Collection: (Application)
-	0x85, 0x02,		// Report Id (2)
-	//
-	0x05, 0x07,		//   Usage Pg (Key Codes)
-	0x19, 0xE0,		//   Usage Min (224)
-	0x29, 0xE7,		//   Usage Max (231)
-	0x15, 0x00,		//   Log Min (0)
-	0x25, 0x01,		//   Log Max (1)
-	//
-	//   Modifier byte
-	0x75, 0x01,		//   Report Size (1)
-	0x95, 0x08,		//   Report Count (8)
-	0x81, 0x02,		//   Input: (Data, Variable, Absolute)
-	//
-	//   Reserved byte
-	0x95, 0x01,		//   Report Count (1)
-	0x75, 0x08,		//   Report Size (8)
-	0x81, 0x01,		//   Input: (Constant)
-	//
-	//   LED report
-	0x05, 0x08,		//   Usage Pg (LEDs)
-	0x19, 0x01,		//   Usage Min (1)
-	0x29, 0x05,		//   Usage Max (5)
-	0x95, 0x05,		//   Report Count (5)
-	0x75, 0x01,		//   Report Size (1)
-	0x91, 0x02,		//   Output: (Data, Variable, Absolute)
-	//
-	//   LED report padding
-	0x95, 0x01,		//   Report Count (1)
-	0x75, 0x03,		//   Report Size (3)
-	0x91, 0x01,		//   Output: (Constant)
-	//
-	//   Key arrays (6 bytes)
-	0x95, 0x06,		//   Report Count (6)
-	0x75, 0x08,		//   Report Size (8)
-	0x15, 0x00,		//   Log Min (0)
-	0x25, 0x65,		//   Log Max (101)
-	0x05, 0x07,		//   Usage Pg (Key Codes)
-	0x19, 0x00,		//   Usage Min (0)
-	0x29, 0x65,		//   Usage Max (101)
-	0x81, 0x00,		//   Input: (Data, Array)
-	//
-	0xC0,			// End Collection
-	//
-	0x05, 0x0C,		// Usage Pg (Consumer Devices)
-	0x09, 0x01,		// Usage (Consumer Control)
-	0xA1, 0x01,		// Collection (Application)
-	0x85, 0x03,		// Report Id (3)
-	0x09, 0x02,		//   Usage (Numeric Key Pad)
-	0xA1, 0x02,		//   Collection (Logical)
-	0x05, 0x09,		//     Usage Pg (Button)
-	0x19, 0x01,		//     Usage Min (Button 1)
-	0x29, 0x0A,		//     Usage Max (Button 10)
-	0x15, 0x01,		//     Logical Min (1)
-	0x25, 0x0A,		//     Logical Max (10)
-	0x75, 0x04,		//     Report Size (4)
-	0x95, 0x01,		//     Report Count (1)
-	0x81, 0x00,		//     Input (Data, Ary, Abs)
-	0xC0,			//   End Collection
-	0x05, 0x0C,		//   Usage Pg (Consumer Devices)
-	0x09, 0x86,		//   Usage (Channel)
-	0x15, 0xFF,		//   Logical Min (-1)
-	0x25, 0x01,		//   Logical Max (1)
-	0x75, 0x02,		//   Report Size (2)
-	0x95, 0x01,		//   Report Count (1)
-	0x81, 0x46,		//   Input (Data, Var, Rel, Null)
-	0x09, 0xE9,		//   Usage (Volume Up)
-	0x09, 0xEA,		//   Usage (Volume Down)
-	0x15, 0x00,		//   Logical Min (0)
-	0x75, 0x01,		//   Report Size (1)
-	0x95, 0x02,		//   Report Count (2)
-	0x81, 0x02,		//   Input (Data, Var, Abs)
-	0x09, 0xE2,		//   Usage (Mute)
-	0x09, 0x30,		//   Usage (Power)
-	0x09, 0x83,		//   Usage (Recall Last)
-	0x09, 0x81,		//   Usage (Assign Selection)
-	0x09, 0xB0,		//   Usage (Play)
-	0x09, 0xB1,		//   Usage (Pause)
-	0x09, 0xB2,		//   Usage (Record)
-	0x09, 0xB3,		//   Usage (Fast Forward)
-	0x09, 0xB4,		//   Usage (Rewind)
-	0x09, 0xB5,		//   Usage (Scan Next)
-	0x09, 0xB6,		//   Usage (Scan Prev)
-	0x09, 0xB7,		//   Usage (Stop)
-	0x15, 0x01,		//   Logical Min (1)
-	0x25, 0x0C,		//   Logical Max (12)
-	0x75, 0x04,		//   Report Size (4)
-	0x95, 0x01,		//   Report Count (1)
-	0x81, 0x00,		//   Input (Data, Ary, Abs)
-	0x09, 0x80,		//   Usage (Selection)
-	0xA1, 0x02,		//   Collection (Logical)
-	0x05, 0x09,		//     Usage Pg (Button)
-	0x19, 0x01,		//     Usage Min (Button 1)
-	0x29, 0x03,		//     Usage Max (Button 3)
-	0x15, 0x01,		//     Logical Min (1)
-	0x25, 0x03,		//     Logical Max (3)
-	0x75, 0x02,		//     Report Size (2)
-	0x81, 0x00,		//     Input (Data, Ary, Abs)
-	0xC0,			//   End Collection
-	0x81, 0x03,		//   Input (Const, Var, Abs)
-	0xC0,			// End Collectionq
-
-	0x06, 0xFF, 0xFF,	// Usage Page(Vendor defined)
-	0x09, 0xA5,		// Usage(Vendor Defined)
-	0xA1, 0x01,		// Collection(Application)
-	0x85, 0x04,		// Report Id (4)
-	0x09, 0xA6,		// Usage(Vendor defined)
-	0x09, 0xA9,		// Usage(Vendor defined)
-	0x75, 0x08,		// Report Size
-	0x95, 0x7F,		// Report Count = 127 Btyes
-	0x91, 0x02,		// Output(Data, Variable, Absolute)
-	0xC0,			// End Collection
+	HID_REPORTS(HID_DESC)
+	HID_LATE_REPORTS(HID_DESC)
 };
 
 hidd_le_env_t hidd_le_env;
 
 // HID report map length
-uint8_t hidReportMapLen = sizeof(hidReportMap);
+uint16_t hidReportMapLen = sizeof(hidReportMap);
+
+// the same map serves the USB interface
+const uint8_t *hid_report_map(uint16_t *len)
+{
+	*len = sizeof(hidReportMap);
+	return hidReportMap;
+}
 uint8_t hidProtocolMode = HID_PROTOCOL_MODE_REPORT;
 
 // HID report mapping table
@@ -202,12 +254,6 @@ static const uint8_t hidInfo[HID_INFORMATION_LEN] = {
 };
 
 static uint16_t hidExtReportRefDesc = ESP_GATT_UUID_BATTERY_LEVEL;
-static uint8_t hidReportRefMouseIn[HID_REPORT_REF_LEN] = { HID_RPT_ID_MOUSE_IN, HID_REPORT_TYPE_INPUT };
-static uint8_t hidReportRefKeyIn[HID_REPORT_REF_LEN] = { HID_RPT_ID_KEY_IN, HID_REPORT_TYPE_INPUT };
-static uint8_t hidReportRefLedOut[HID_REPORT_REF_LEN] = { HID_RPT_ID_LED_OUT, HID_REPORT_TYPE_OUTPUT };
-static uint8_t hidReportRefVendorOut[HID_REPORT_REF_LEN] = { HID_RPT_ID_VENDOR_OUT, HID_REPORT_TYPE_OUTPUT };
-static uint8_t hidReportRefFeature[HID_REPORT_REF_LEN] = { HID_RPT_ID_FEATURE, HID_REPORT_TYPE_FEATURE };
-static uint8_t hidReportRefCCIn[HID_REPORT_REF_LEN] = { HID_RPT_ID_CC_IN, HID_REPORT_TYPE_INPUT };
 
 static uint16_t hid_le_svc = ATT_SVC_HID;
 uint16_t hid_count = 0;
@@ -220,11 +266,7 @@ static const uint16_t character_client_config_uuid = ESP_GATT_UUID_CHAR_CLIENT_C
 static const uint16_t hid_info_char_uuid = ESP_GATT_UUID_HID_INFORMATION;
 static const uint16_t hid_report_map_uuid = ESP_GATT_UUID_HID_REPORT_MAP;
 static const uint16_t hid_control_point_uuid = ESP_GATT_UUID_HID_CONTROL_POINT;
-static const uint16_t hid_report_uuid = ESP_GATT_UUID_HID_REPORT;
 static const uint16_t hid_proto_mode_uuid = ESP_GATT_UUID_HID_PROTO_MODE;
-static const uint16_t hid_kb_input_uuid = ESP_GATT_UUID_HID_BT_KB_INPUT;
-static const uint16_t hid_kb_output_uuid = ESP_GATT_UUID_HID_BT_KB_OUTPUT;
-static const uint16_t hid_mouse_input_uuid = ESP_GATT_UUID_HID_BT_MOUSE_INPUT;
 static const uint16_t hid_repot_map_ext_desc_uuid = ESP_GATT_UUID_EXT_RPT_REF_DESCR;
 static const uint16_t hid_report_ref_descr_uuid = ESP_GATT_UUID_RPT_REF_DESCR;
 ///the propoty definition
@@ -232,6 +274,7 @@ static const uint8_t char_prop_notify = ESP_GATT_CHAR_PROP_BIT_NOTIFY;
 static const uint8_t char_prop_read = ESP_GATT_CHAR_PROP_BIT_READ;
 static const uint8_t char_prop_write_nr = ESP_GATT_CHAR_PROP_BIT_WRITE_NR;
 static const uint8_t char_prop_read_write = ESP_GATT_CHAR_PROP_BIT_WRITE | ESP_GATT_CHAR_PROP_BIT_READ;
+static const uint8_t char_prop_read_write_nr = ESP_GATT_CHAR_PROP_BIT_WRITE_NR | ESP_GATT_CHAR_PROP_BIT_READ;
 static const uint8_t char_prop_read_notify = ESP_GATT_CHAR_PROP_BIT_READ | ESP_GATT_CHAR_PROP_BIT_NOTIFY;
 static const uint8_t char_prop_read_write_notify = ESP_GATT_CHAR_PROP_BIT_READ | ESP_GATT_CHAR_PROP_BIT_WRITE | ESP_GATT_CHAR_PROP_BIT_NOTIFY;
 static const uint8_t char_prop_read_write_write_nr = ESP_GATT_CHAR_PROP_BIT_READ | ESP_GATT_CHAR_PROP_BIT_WRITE | ESP_GATT_CHAR_PROP_BIT_WRITE_NR;
@@ -282,7 +325,56 @@ const esp_gatts_attr_db_t bas_att_db[BAS_IDX_NB] = {
 					sizeof(struct prf_char_pres_fmt), 0, NULL}},
 };
 
+// Attributes for one report: declaration, value, then the CCC for inputs.
+// Values are sized to the report, the stack allocates max_length for each.
+#define HID_ATTR_CHAR(n, prop) \
+	[HIDD_LE_IDX_##n##_CHAR] = {{ESP_GATT_AUTO_RSP}, \
+				    {ESP_UUID_LEN_16, (uint8_t *) & character_declaration_uuid, \
+				     ESP_GATT_PERM_READ, \
+				     sizeof(uint8_t), sizeof(uint8_t), \
+				     (uint8_t *) & prop} \
+				   },
+#define HID_ATTR_VAL(n, uuid, perm, len, init_len, init) \
+	[HIDD_LE_IDX_##n##_VAL] = {{ESP_GATT_AUTO_RSP}, \
+				   {ESP_UUID_LEN_16, (uint8_t *) & (const uint16_t){ uuid }, \
+				    perm, \
+				    len, init_len, \
+				    init} \
+				  },
+#define HID_ATTR_CCC(n) \
+	[HIDD_LE_IDX_##n##_CCC] = {{ESP_GATT_AUTO_RSP}, \
+				   {ESP_UUID_LEN_16, (uint8_t *) & character_client_config_uuid, \
+				    (ESP_GATT_PERM_READ | ESP_GATT_PERM_WRITE), \
+				    sizeof(uint16_t), 0, \
+				    NULL} \
+				  },
+#define HID_ATTRS_INPUT(n, uuid, len) \
+	HID_ATTR_CHAR(n, char_prop_read_notify) \
+	HID_ATTR_VAL(n, uuid, ESP_GATT_PERM_READ, len, 0, NULL) \
+	HID_ATTR_CCC(n)
+#define HID_ATTRS_OUTPUT(n, uuid, len) \
+	HID_ATTR_CHAR(n, char_prop_read_write_write_nr) \
+	HID_ATTR_VAL(n, uuid, ESP_GATT_PERM_READ | ESP_GATT_PERM_WRITE, len, 0, NULL)
+// hosts read features before they write them, so those start out zeroed
+#define HID_ATTRS_FEATURE(n, uuid, len) \
+	HID_ATTR_CHAR(n, char_prop_read_write) \
+	HID_ATTR_VAL(n, uuid, ESP_GATT_PERM_READ | ESP_GATT_PERM_WRITE, len, len, (uint8_t [len]){ 0 })
+#define HID_ATTRS_REPORT(name, id, type, len) \
+	HID_ATTRS_##type(REPORT_##name, ESP_GATT_UUID_HID_REPORT, len) \
+	[HIDD_LE_IDX_REPORT_##name##_REP_REF] = {{ESP_GATT_AUTO_RSP}, \
+						{ESP_UUID_LEN_16, (uint8_t *) & hid_report_ref_descr_uuid, \
+						 ESP_GATT_PERM_READ, \
+						 HID_REPORT_REF_LEN, HID_REPORT_REF_LEN, \
+						 (uint8_t []){ id, HID_REPORT_TYPE_##type }} \
+						},
+#define HID_ATTRS_BOOT(name, id, type, len, uuid) \
+	HID_ATTRS_##type(BOOT_##name, uuid, len)
+
 /// Full Hid device Database Description - Used to add attributes into the database
+/// Hosts without robust caching keep the handles they discovered across a
+/// firmware update, so attributes that shipped keep their place and new
+/// ones go in HID_LATE_REPORTS.  Any change, appending too, alters the
+/// database hash, and hosts that read it rediscover once.
 esp_gatts_attr_db_t hidd_le_gatt_db[HIDD_LE_IDX_NB] = {
 	// HID Service Declaration
 	[HIDD_LE_IDX_SVC] = {{ESP_GATT_AUTO_RSP},
@@ -342,7 +434,7 @@ esp_gatts_attr_db_t hidd_le_gatt_db[HIDD_LE_IDX_NB] = {
 	[HIDD_LE_IDX_REPORT_MAP_VAL] = {{ESP_GATT_AUTO_RSP},
 					{ESP_UUID_LEN_16, (uint8_t *) & hid_report_map_uuid,
 					 ESP_GATT_PERM_READ,
-					 HIDD_LE_REPORT_MAP_MAX_LEN, sizeof(hidReportMap),
+					 sizeof(hidReportMap), sizeof(hidReportMap),
 					 (uint8_t *) & hidReportMap}
 					},
 
@@ -359,7 +451,7 @@ esp_gatts_attr_db_t hidd_le_gatt_db[HIDD_LE_IDX_NB] = {
 					 {ESP_UUID_LEN_16, (uint8_t *) & character_declaration_uuid,
 					  ESP_GATT_PERM_READ,
 					  sizeof(uint8_t), sizeof(uint8_t),
-					  (uint8_t *) & char_prop_read_write}
+					  (uint8_t *) & char_prop_read_write_nr}
 					 },
 	// Protocol Mode Characteristic Value
 	[HIDD_LE_IDX_PROTO_MODE_VAL] = {{ESP_GATT_AUTO_RSP},
@@ -369,272 +461,57 @@ esp_gatts_attr_db_t hidd_le_gatt_db[HIDD_LE_IDX_NB] = {
 					 (uint8_t *) & hidProtocolMode}
 					},
 
-	[HIDD_LE_IDX_REPORT_MOUSE_IN_CHAR] = {{ESP_GATT_AUTO_RSP},
-					      {ESP_UUID_LEN_16, (uint8_t *) & character_declaration_uuid,
-					       ESP_GATT_PERM_READ,
-					       sizeof(uint8_t), sizeof(uint8_t),
-					       (uint8_t *) & char_prop_read_notify}
-					      },
-
-	[HIDD_LE_IDX_REPORT_MOUSE_IN_VAL] = {{ESP_GATT_AUTO_RSP},
-					     {ESP_UUID_LEN_16, (uint8_t *) & hid_report_uuid,
-					      ESP_GATT_PERM_READ,
-					      HIDD_LE_REPORT_MAX_LEN, 0,
-					      NULL}
-					     },
-
-	[HIDD_LE_IDX_REPORT_MOUSE_IN_CCC] = {{ESP_GATT_AUTO_RSP},
-					     {ESP_UUID_LEN_16, (uint8_t *) & character_client_config_uuid,
-					      (ESP_GATT_PERM_READ | ESP_GATT_PERM_WRITE),
-					      sizeof(uint16_t), 0,
-					      NULL}
-					     },
-
-	[HIDD_LE_IDX_REPORT_MOUSE_REP_REF] = {{ESP_GATT_AUTO_RSP},
-					      {ESP_UUID_LEN_16, (uint8_t *) & hid_report_ref_descr_uuid,
-					       ESP_GATT_PERM_READ,
-					       sizeof(hidReportRefMouseIn), sizeof(hidReportRefMouseIn),
-					       hidReportRefMouseIn}
-					      },
-	// Report Characteristic Declaration
-	[HIDD_LE_IDX_REPORT_KEY_IN_CHAR] = {{ESP_GATT_AUTO_RSP},
-					    {ESP_UUID_LEN_16, (uint8_t *) & character_declaration_uuid,
-					     ESP_GATT_PERM_READ,
-					     sizeof(uint8_t), sizeof(uint8_t),
-					     (uint8_t *) & char_prop_read_notify}
-					    },
-	// Report Characteristic Value
-	[HIDD_LE_IDX_REPORT_KEY_IN_VAL] = {{ESP_GATT_AUTO_RSP},
-					   {ESP_UUID_LEN_16, (uint8_t *) & hid_report_uuid,
-					    ESP_GATT_PERM_READ,
-					    HIDD_LE_REPORT_MAX_LEN, 0,
-					    NULL}
-					   },
-	// Report KEY INPUT Characteristic - Client Characteristic Configuration Descriptor
-	[HIDD_LE_IDX_REPORT_KEY_IN_CCC] = {{ESP_GATT_AUTO_RSP},
-					   {ESP_UUID_LEN_16, (uint8_t *) & character_client_config_uuid,
-					    (ESP_GATT_PERM_READ | ESP_GATT_PERM_WRITE),
-					    sizeof(uint16_t), 0,
-					    NULL}
-					   },
-	// Report Characteristic - Report Reference Descriptor
-	[HIDD_LE_IDX_REPORT_KEY_IN_REP_REF] = {{ESP_GATT_AUTO_RSP},
-					       {ESP_UUID_LEN_16, (uint8_t *) & hid_report_ref_descr_uuid,
-						ESP_GATT_PERM_READ,
-						sizeof(hidReportRefKeyIn), sizeof(hidReportRefKeyIn),
-						hidReportRefKeyIn}
-					       },
-
-	// Report Characteristic Declaration
-	[HIDD_LE_IDX_REPORT_LED_OUT_CHAR] = {{ESP_GATT_AUTO_RSP},
-					     {ESP_UUID_LEN_16, (uint8_t *) & character_declaration_uuid,
-					      ESP_GATT_PERM_READ,
-					      sizeof(uint8_t), sizeof(uint8_t),
-					      (uint8_t *) & char_prop_read_write_write_nr}
-					     },
-
-	[HIDD_LE_IDX_REPORT_LED_OUT_VAL] = {{ESP_GATT_AUTO_RSP},
-					    {ESP_UUID_LEN_16, (uint8_t *) & hid_report_uuid,
-					     ESP_GATT_PERM_READ | ESP_GATT_PERM_WRITE,
-					     HIDD_LE_REPORT_MAX_LEN, 0,
-					     NULL}
-					    },
-	[HIDD_LE_IDX_REPORT_LED_OUT_REP_REF] = {{ESP_GATT_AUTO_RSP},
-						{ESP_UUID_LEN_16, (uint8_t *) & hid_report_ref_descr_uuid,
-						 ESP_GATT_PERM_READ,
-						 sizeof(hidReportRefLedOut), sizeof(hidReportRefLedOut),
-						 hidReportRefLedOut}
-						},
-	// Report Characteristic Declaration
-	[HIDD_LE_IDX_REPORT_VENDOR_OUT_CHAR] = {{ESP_GATT_AUTO_RSP},
-						{ESP_UUID_LEN_16, (uint8_t *) & character_declaration_uuid,
-						 ESP_GATT_PERM_READ,
-						 sizeof(uint8_t), sizeof(uint8_t),
-						 (uint8_t *) & char_prop_read_write_notify}
-						},
-	[HIDD_LE_IDX_REPORT_VENDOR_OUT_VAL] = {{ESP_GATT_AUTO_RSP},
-					       {ESP_UUID_LEN_16, (uint8_t *) & hid_report_uuid,
-						ESP_GATT_PERM_READ | ESP_GATT_PERM_WRITE,
-						HIDD_LE_REPORT_MAX_LEN, 0,
-						NULL}
-					       },
-	[HIDD_LE_IDX_REPORT_VENDOR_OUT_REP_REF] = {{ESP_GATT_AUTO_RSP},
-						   {ESP_UUID_LEN_16, (uint8_t *) & hid_report_ref_descr_uuid,
-						    ESP_GATT_PERM_READ,
-						    sizeof(hidReportRefVendorOut), sizeof(hidReportRefVendorOut),
-						    hidReportRefVendorOut}
-						   },
-	// Report Characteristic Declaration
-	[HIDD_LE_IDX_REPORT_CC_IN_CHAR] = {{ESP_GATT_AUTO_RSP},
-					   {ESP_UUID_LEN_16, (uint8_t *) & character_declaration_uuid,
-					    ESP_GATT_PERM_READ,
-					    sizeof(uint8_t), sizeof(uint8_t),
-					    (uint8_t *) & char_prop_read_notify}
-					   },
-	// Report Characteristic Value
-	[HIDD_LE_IDX_REPORT_CC_IN_VAL] = {{ESP_GATT_AUTO_RSP},
-					  {ESP_UUID_LEN_16, (uint8_t *) & hid_report_uuid,
-					   ESP_GATT_PERM_READ,
-					   HIDD_LE_REPORT_MAX_LEN, 0,
-					   NULL}
-					  },
-	// Report KEY INPUT Characteristic - Client Characteristic Configuration Descriptor
-	[HIDD_LE_IDX_REPORT_CC_IN_CCC] = {{ESP_GATT_AUTO_RSP},
-					  {ESP_UUID_LEN_16, (uint8_t *) & character_client_config_uuid,
-					   (ESP_GATT_PERM_READ | ESP_GATT_PERM_WRITE_ENCRYPTED),
-					   sizeof(uint16_t), 0,
-					   NULL}
-					  },
-	// Report Characteristic - Report Reference Descriptor
-	[HIDD_LE_IDX_REPORT_CC_IN_REP_REF] = {{ESP_GATT_AUTO_RSP},
-					      {ESP_UUID_LEN_16, (uint8_t *) & hid_report_ref_descr_uuid,
-					       ESP_GATT_PERM_READ,
-					       sizeof(hidReportRefCCIn), sizeof(hidReportRefCCIn),
-					       hidReportRefCCIn}
-					      },
-
-	// Boot Keyboard Input Report Characteristic Declaration
-	[HIDD_LE_IDX_BOOT_KB_IN_REPORT_CHAR] = {{ESP_GATT_AUTO_RSP},
-						{ESP_UUID_LEN_16, (uint8_t *) & character_declaration_uuid,
-						 ESP_GATT_PERM_READ,
-						 sizeof(uint8_t), sizeof(uint8_t),
-						 (uint8_t *) & char_prop_read_notify}
-						},
-	// Boot Keyboard Input Report Characteristic Value
-	[HIDD_LE_IDX_BOOT_KB_IN_REPORT_VAL] = {{ESP_GATT_AUTO_RSP},
-					       {ESP_UUID_LEN_16, (uint8_t *) & hid_kb_input_uuid,
-						ESP_GATT_PERM_READ,
-						HIDD_LE_BOOT_REPORT_MAX_LEN, 0,
-						NULL}
-					       },
-	// Boot Keyboard Input Report Characteristic - Client Characteristic Configuration Descriptor
-	[HIDD_LE_IDX_BOOT_KB_IN_REPORT_NTF_CFG] = {{ESP_GATT_AUTO_RSP},
-						   {ESP_UUID_LEN_16, (uint8_t *) & character_client_config_uuid,
-						    (ESP_GATT_PERM_READ | ESP_GATT_PERM_WRITE),
-						    sizeof(uint16_t), 0,
-						    NULL}
-						   },
-
-	// Boot Keyboard Output Report Characteristic Declaration
-	[HIDD_LE_IDX_BOOT_KB_OUT_REPORT_CHAR] = {{ESP_GATT_AUTO_RSP},
-						 {ESP_UUID_LEN_16, (uint8_t *) & character_declaration_uuid,
-						  ESP_GATT_PERM_READ,
-						  sizeof(uint8_t), sizeof(uint8_t),
-						  (uint8_t *) & char_prop_read_write}
-						 },
-	// Boot Keyboard Output Report Characteristic Value
-	[HIDD_LE_IDX_BOOT_KB_OUT_REPORT_VAL] = {{ESP_GATT_AUTO_RSP},
-						{ESP_UUID_LEN_16, (uint8_t *) & hid_kb_output_uuid,
-						 (ESP_GATT_PERM_READ | ESP_GATT_PERM_WRITE),
-						 HIDD_LE_BOOT_REPORT_MAX_LEN, 0,
-						 NULL}
-						},
-
-	// Boot Mouse Input Report Characteristic Declaration
-	[HIDD_LE_IDX_BOOT_MOUSE_IN_REPORT_CHAR] = {{ESP_GATT_AUTO_RSP},
-						   {ESP_UUID_LEN_16, (uint8_t *) & character_declaration_uuid,
-						    ESP_GATT_PERM_READ,
-						    sizeof(uint8_t), sizeof(uint8_t),
-						    (uint8_t *) & char_prop_read_notify}
-						   },
-	// Boot Mouse Input Report Characteristic Value
-	[HIDD_LE_IDX_BOOT_MOUSE_IN_REPORT_VAL] = {{ESP_GATT_AUTO_RSP},
-						  {ESP_UUID_LEN_16, (uint8_t *) & hid_mouse_input_uuid,
-						   ESP_GATT_PERM_READ,
-						   HIDD_LE_BOOT_REPORT_MAX_LEN, 0,
-						   NULL}
-						  },
-	// Boot Mouse Input Report Characteristic - Client Characteristic Configuration Descriptor
-	[HIDD_LE_IDX_BOOT_MOUSE_IN_REPORT_NTF_CFG] = {{ESP_GATT_AUTO_RSP},
-						      {ESP_UUID_LEN_16, (uint8_t *) & character_client_config_uuid,
-						       (ESP_GATT_PERM_READ | ESP_GATT_PERM_WRITE),
-						       sizeof(uint16_t), 0,
-						       NULL}
-						      },
-
-	// Report Characteristic Declaration
-	[HIDD_LE_IDX_REPORT_CHAR] = {{ESP_GATT_AUTO_RSP},
-				     {ESP_UUID_LEN_16, (uint8_t *) & character_declaration_uuid,
-				      ESP_GATT_PERM_READ,
-				      sizeof(uint8_t), sizeof(uint8_t),
-				      (uint8_t *) & char_prop_read_write}
-				     },
-	// Report Characteristic Value
-	[HIDD_LE_IDX_REPORT_VAL] = {{ESP_GATT_AUTO_RSP},
-				    {ESP_UUID_LEN_16, (uint8_t *) & hid_report_uuid,
-				     ESP_GATT_PERM_READ,
-				     HIDD_LE_REPORT_MAX_LEN, 0,
-				     NULL}
-				    },
-	// Report Characteristic - Report Reference Descriptor
-	[HIDD_LE_IDX_REPORT_REP_REF] = {{ESP_GATT_AUTO_RSP},
-					{ESP_UUID_LEN_16, (uint8_t *) & hid_report_ref_descr_uuid,
-					 ESP_GATT_PERM_READ,
-					 sizeof(hidReportRefFeature), sizeof(hidReportRefFeature),
-					 hidReportRefFeature}
-					},
+	HID_REPORTS(HID_ATTRS_REPORT)
+	HID_BOOT_REPORTS(HID_ATTRS_BOOT)
+	HID_LATE_REPORTS(HID_ATTRS_REPORT)
 };
 
+#define HID_MAP_INPUT(n)    hidd_le_env.hidd_inst.att_tbl[HIDD_LE_IDX_##n##_CCC]
+#define HID_MAP_OUTPUT(n)   0
+#define HID_MAP_FEATURE(n)  0
+#define HID_MAP(n, id_, type_, mode_, len_) \
+	{ \
+		.handle = hidd_le_env.hidd_inst.att_tbl[HIDD_LE_IDX_##n##_VAL], \
+		.cccdHandle = HID_MAP_##type_(n), \
+		.id = id_, \
+		.type = HID_REPORT_TYPE_##type_, \
+		.mode = mode_, \
+		.len = len_, \
+	},
+#define HID_MAP_REPORT(name, id, type, len)     HID_MAP(REPORT_##name, id, type, HID_PROTOCOL_MODE_REPORT, len)
+#define HID_MAP_BOOT(name, id, type, len, uuid) HID_MAP(BOOT_##name, id, type, HID_PROTOCOL_MODE_BOOT, len)
+
 void hid_add_id_tbl(void)
 {
-	// Mouse input report
-	hid_rpt_map[0].id = hidReportRefMouseIn[0];
-	hid_rpt_map[0].type = hidReportRefMouseIn[1];
-	hid_rpt_map[0].handle = hidd_le_env.hidd_inst.att_tbl[HIDD_LE_IDX_REPORT_MOUSE_IN_VAL];
-	hid_rpt_map[0].cccdHandle = hidd_le_env.hidd_inst.att_tbl[HIDD_LE_IDX_REPORT_MOUSE_IN_VAL];
-	hid_rpt_map[0].mode = HID_PROTOCOL_MODE_REPORT;
-
-	// Key input report
-	hid_rpt_map[1].id = hidReportRefKeyIn[0];
-	hid_rpt_map[1].type = hidReportRefKeyIn[1];
-	hid_rpt_map[1].handle = hidd_le_env.hidd_inst.att_tbl[HIDD_LE_IDX_REPORT_KEY_IN_VAL];
-	hid_rpt_map[1].cccdHandle = hidd_le_env.hidd_inst.att_tbl[HIDD_LE_IDX_REPORT_KEY_IN_CCC];
-	hid_rpt_map[1].mode = HID_PROTOCOL_MODE_REPORT;
-
-	// Consumer Control input report
-	hid_rpt_map[2].id = hidReportRefCCIn[0];
-	hid_rpt_map[2].type = hidReportRefCCIn[1];
-	hid_rpt_map[2].handle = hidd_le_env.hidd_inst.att_tbl[HIDD_LE_IDX_REPORT_CC_IN_VAL];
-	hid_rpt_map[2].cccdHandle = hidd_le_env.hidd_inst.att_tbl[HIDD_LE_IDX_REPORT_CC_IN_CCC];
-	hid_rpt_map[2].mode = HID_PROTOCOL_MODE_REPORT;
-
-	// LED output report
-	hid_rpt_map[3].id = hidReportRefLedOut[0];
-	hid_rpt_map[3].type = hidReportRefLedOut[1];
-	hid_rpt_map[3].handle = hidd_le_env.hidd_inst.att_tbl[HIDD_LE_IDX_REPORT_LED_OUT_VAL];
-	hid_rpt_map[3].cccdHandle = 0;
-	hid_rpt_map[3].mode = HID_PROTOCOL_MODE_REPORT;
-
-	// Boot keyboard input report
-	// Use same ID and type as key input report
-	hid_rpt_map[4].id = hidReportRefKeyIn[0];
-	hid_rpt_map[4].type = hidReportRefKeyIn[1];
-	hid_rpt_map[4].handle = hidd_le_env.hidd_inst.att_tbl[HIDD_LE_IDX_BOOT_KB_IN_REPORT_VAL];
-	hid_rpt_map[4].cccdHandle = 0;
-	hid_rpt_map[4].mode = HID_PROTOCOL_MODE_BOOT;
-
-	// Boot keyboard output report
-	// Use same ID and type as LED output report
-	hid_rpt_map[5].id = hidReportRefLedOut[0];
-	hid_rpt_map[5].type = hidReportRefLedOut[1];
-	hid_rpt_map[5].handle = hidd_le_env.hidd_inst.att_tbl[HIDD_LE_IDX_BOOT_KB_OUT_REPORT_VAL];
-	hid_rpt_map[5].cccdHandle = 0;
-	hid_rpt_map[5].mode = HID_PROTOCOL_MODE_BOOT;
-
-	// Boot mouse input report
-	// Use same ID and type as mouse input report
-	hid_rpt_map[6].id = hidReportRefMouseIn[0];
-	hid_rpt_map[6].type = hidReportRefMouseIn[1];
-	hid_rpt_map[6].handle = hidd_le_env.hidd_inst.att_tbl[HIDD_LE_IDX_BOOT_MOUSE_IN_REPORT_VAL];
-	hid_rpt_map[6].cccdHandle = 0;
-	hid_rpt_map[6].mode = HID_PROTOCOL_MODE_BOOT;
-
-	// Feature report
-	hid_rpt_map[7].id = hidReportRefFeature[0];
-	hid_rpt_map[7].type = hidReportRefFeature[1];
-	hid_rpt_map[7].handle = hidd_le_env.hidd_inst.att_tbl[HIDD_LE_IDX_REPORT_VAL];
-	hid_rpt_map[7].cccdHandle = 0;
-	hid_rpt_map[7].mode = HID_PROTOCOL_MODE_REPORT;
+	const hid_report_map_t map[HID_NUM_REPORTS] = {
+		HID_REPORTS(HID_MAP_REPORT)
+		HID_BOOT_REPORTS(HID_MAP_BOOT)
+		HID_LATE_REPORTS(HID_MAP_REPORT)
+	};
+	uint32_t bytes = 0;
+
+	memcpy(hid_rpt_map, map, sizeof(map));
+	memset(hid_rpt_idx, 0, sizeof(hid_rpt_idx));
+	for (int i = 0; i < HID_NUM_REPORTS; i++) {
+		hid_report_map_t *rpt = &hid_rpt_map[i];
+
+		if (rpt->handle && rpt->mode <= HID_PROTOCOL_MODE_REPORT && rpt->type <= HID_REPORT_TYPE_FEATURE && rpt->id < HID_RPT_ID_NB) {
+			hid_rpt_idx[rpt->mode][rpt->type][rpt->id] = rpt;
+		}
+	}
+	for (int i = 0; i < HIDD_LE_IDX_NB; i++) {
+		bytes += hidd_le_gatt_db[i].att_desc.max_length;
+	}
+	ESP_LOGI(HID_LE_PRF_TAG, "hid service: %d attributes, %d reports, %d value bytes",
+		HIDD_LE_IDX_NB, HID_NUM_REPORTS, (int)bytes);
+}
+
+// reports only go to one host at a time, so the mode is that host's
+void hid_set_protocol_mode(uint8_t mode)
+{
+	if (mode <= HID_PROTOCOL_MODE_REPORT) {
+		hidProtocolMode = mode;
+	}
 }
 
 esp_err_t esp_hidd_profile_init(void)
@@ -722,40 +599,93 @@ void hidd_le_init(void)
 	memset(&hidd_le_env, 0, sizeof(hidd_le_env_t));
 }
 
-void hidd_clcb_alloc(uint16_t conn_id, esp_bd_addr_t bda)
+/*
+ * A slot keeps the address of its last host after disconnecting, so a
+ * host reconnecting gets its old slot back and keymap host switching
+ * stays stable.  New hosts take a never used slot before evicting one.
+ */
+hidd_clcb_t *hidd_clcb_alloc(uint16_t conn_id, esp_bd_addr_t bda)
 {
+	static const esp_bd_addr_t none = { 0 };
 	uint8_t i_clcb = 0;
-	hidd_clcb_t *p_clcb = NULL;
+	hidd_clcb_t *p_clcb = NULL, *p_free = NULL, *p_unused = NULL;
 
 	for (i_clcb = 0, p_clcb = hidd_le_env.hidd_clcb; i_clcb < HID_MAX_APPS; i_clcb++, p_clcb++) {
-		if (!p_clcb->in_use) {
-			p_clcb->in_use = true;
-			p_clcb->conn_id = conn_id;
-			p_clcb->connected = true;
-			memcpy(p_clcb->remote_bda, bda, ESP_BD_ADDR_LEN);
+		if (p_clcb->in_use) {
+			continue;
+		}
+		if (!memcmp(p_clcb->remote_bda, bda, ESP_BD_ADDR_LEN)) {
 			break;
 		}
+		if (!p_unused && !memcmp(p_clcb->remote_bda, none, ESP_BD_ADDR_LEN)) {
+			p_unused = p_clcb;
+		}
+		if (!p_free) {
+			p_free = p_clcb;
+		}
 	}
-	return;
+	if (i_clcb == HID_MAX_APPS) {
+		p_clcb = p_unused ? p_unused : p_free;
+	}
+	if (p_clcb == NULL) {
+		return NULL;
+	}
+
+	p_clcb->in_use = true;
+	p_clcb->conn_id = conn_id;
+	p_clcb->connected = true;
+	p_clcb->secure = false;
+	p_clcb->congest = false;
+	p_clcb->proto_mode = HID_PROTOCOL_MODE_REPORT;
+	p_clcb->resolution = 0;
+	memcpy(p_clcb->remote_bda, bda, ESP_BD_ADDR_LEN);
+	return p_clcb;
 }
 
 bool hidd_clcb_dealloc(uint16_t conn_id)
+{
+	hidd_clcb_t *p_clcb;
+
+	if ((p_clcb = hidd_clcb_find(conn_id)) == NULL) {
+		return false;
+	}
+	p_clcb->in_use = false;
+	p_clcb->connected = false;
+	p_clcb->secure = false;
+	p_clcb->congest = false;
+	return true;
+}
+
+hidd_clcb_t *hidd_clcb_by_bda(esp_bd_addr_t bda)
 {
 	uint8_t i_clcb = 0;
 	hidd_clcb_t *p_clcb = NULL;
 
 	for (i_clcb = 0, p_clcb = hidd_le_env.hidd_clcb; i_clcb < HID_MAX_APPS; i_clcb++, p_clcb++) {
-		memset(p_clcb, 0, sizeof(hidd_clcb_t));
-		return true;
+		if (p_clcb->in_use && !memcmp(p_clcb->remote_bda, bda, ESP_BD_ADDR_LEN)) {
+			return p_clcb;
+		}
 	}
+	return NULL;
+}
 
-	return false;
+hidd_clcb_t *hidd_clcb_find(uint16_t conn_id)
+{
+	uint8_t i_clcb = 0;
+	hidd_clcb_t *p_clcb = NULL;
+
+	for (i_clcb = 0, p_clcb = hidd_le_env.hidd_clcb; i_clcb < HID_MAX_APPS; i_clcb++, p_clcb++) {
+		if (p_clcb->in_use && p_clcb->conn_id == conn_id) {
+			return p_clcb;
+		}
+	}
+	return NULL;
 }
 
 void hidd_set_attr_value(uint16_t handle, uint16_t val_len, const uint8_t *value)
 {
 	hidd_inst_t *hidd_inst = &hidd_le_env.hidd_inst;
-	if (hidd_inst->att_tbl[HIDD_LE_IDX_HID_INFO_VAL] <= handle && hidd_inst->att_tbl[HIDD_LE_IDX_REPORT_REP_REF] >= handle) {
+	if (hidd_inst->att_tbl[HIDD_LE_IDX_HID_INFO_VAL] <= handle && hidd_inst->att_tbl[HIDD_LE_IDX_NB - 1] >= handle) {
 		esp_ble_gatts_set_attr_value(handle, val_len, value);
 	} else {
 		ESP_LOGE(HID_LE_PRF_TAG, "%s error:Invalid handle value.", __func__);
@@ -766,7 +696,7 @@ void hidd_set_attr_value(uint16_t handle, uint16_t val_len, const uint8_t *value
 void hidd_get_attr_value(uint16_t handle, uint16_t *length, uint8_t **value)
 {
 	hidd_inst_t *hidd_inst = &hidd_le_env.hidd_inst;
-	if (hidd_inst->att_tbl[HIDD_LE_IDX_HID_INFO_VAL] <= handle && hidd_inst->att_tbl[HIDD_LE_IDX_REPORT_REP_REF] >= handle) {
+	if (hidd_inst->att_tbl[HIDD_LE_IDX_HID_INFO_VAL] <= handle && hidd_inst->att_tbl[HIDD_LE_IDX_NB - 1] >= handle) {
 		esp_ble_gatts_get_attr_value(handle, length, (const uint8_t **)value);
 	} else {
 		ESP_LOGE(HID_LE_PRF_TAG, "%s error:Invalid handle value.", __func__);
@@ -777,15 +707,10 @@ void hidd_get_attr_value(uint16_t handle, uint16_t *length, uint8_t **value)
 
 static hid_report_map_t *hid_dev_rpt_by_id(uint8_t id, uint8_t type)
 {
-	hid_report_map_t *rpt = hid_rpt_map;
-
-	for (uint8_t i = HID_NUM_REPORTS; i > 0; i--, rpt++) {
-		if (rpt->id == id && rpt->type == type && rpt->mode == hidProtocolMode) {
-			return rpt;
-		}
+	if (id >= HID_RPT_ID_NB || type > HID_REPORT_TYPE_FEATURE) {
+		return NULL;
 	}
-
-	return NULL;
+	return hid_rpt_idx[hidProtocolMode][type][id];
 }
 
 int hid_dev_send_report(esp_gatt_if_t gatts_if, uint16_t conn_id, uint8_t id, uint8_t type, uint8_t length, uint8_t *data)
@@ -796,87 +721,53 @@ int hid_dev_send_report(esp_gatt_if_t gatts_if, uint16_t conn_id, uint8_t id, ui
 	if ((p_rpt = hid_dev_rpt_by_id(id, type)) != NULL) {
 		// if notifications are enabled
 		ESP_LOGD(HID_LE_PRF_TAG, "%s(), send the report, handle = %d", __func__, p_rpt->handle);
+		if (p_rpt->len && length > p_rpt->len) {
+			length = p_rpt->len;
+		}
 		return esp_ble_gatts_send_indicate(gatts_if, conn_id, p_rpt->handle, length, data, false);
 	}
-	return 1;
+	return HID_RPT_NOT_FOUND;
 
 }
 
+/*
+ * Where each consumer usage lands in the 2-byte report: the byte, the bits
+ * of it other fields own, and the value.  Usages the report map doesn't
+ * declare stay zero and build nothing.
+ */
+#define HID_CC(byte_, keep_, set_)  { .byte = byte_, .keep = keep_, .set = set_ }
+static const struct {
+	uint8_t byte;
+	uint8_t keep;
+	uint8_t set;
+} hid_cc_fields[256] = {
+	[HID_CONSUMER_CHANNEL_UP]    = HID_CC(0, HID_CC_RPT_CHANNEL_BITS, (HID_CC_RPT_CHANNEL_UP & 0x03) << 4),
+	[HID_CONSUMER_CHANNEL_DOWN]  = HID_CC(0, HID_CC_RPT_CHANNEL_BITS, (HID_CC_RPT_CHANNEL_DOWN & 0x03) << 4),
+	[HID_CONSUMER_VOLUME_UP]     = HID_CC(0, HID_CC_RPT_VOLUME_BITS, HID_CC_RPT_VOLUME_UP),
+	[HID_CONSUMER_VOLUME_DOWN]   = HID_CC(0, HID_CC_RPT_VOLUME_BITS, HID_CC_RPT_VOLUME_DOWN),
+	[HID_CONSUMER_MUTE]          = HID_CC(1, HID_CC_RPT_BUTTON_BITS, HID_CC_RPT_MUTE),
+	[HID_CONSUMER_POWER]         = HID_CC(1, HID_CC_RPT_BUTTON_BITS, HID_CC_RPT_POWER),
+	[HID_CONSUMER_RECALL_LAST]   = HID_CC(1, HID_CC_RPT_BUTTON_BITS, HID_CC_RPT_LAST),
+	[HID_CONSUMER_ASSIGN_SEL]    = HID_CC(1, HID_CC_RPT_BUTTON_BITS, HID_CC_RPT_ASSIGN_SEL),
+	[HID_CONSUMER_PLAY]          = HID_CC(1, HID_CC_RPT_BUTTON_BITS, HID_CC_RPT_PLAY),
+	[HID_CONSUMER_PAUSE]         = HID_CC(1, HID_CC_RPT_BUTTON_BITS, HID_CC_RPT_PAUSE),
+	[HID_CONSUMER_RECORD]        = HID_CC(1, HID_CC_RPT_BUTTON_BITS, HID_CC_RPT_RECORD),
+	[HID_CONSUMER_FAST_FORWARD]  = HID_CC(1, HID_CC_RPT_BUTTON_BITS, HID_CC_RPT_FAST_FWD),
+	[HID_CONSUMER_REWIND]        = HID_CC(1, HID_CC_RPT_BUTTON_BITS, HID_CC_RPT_REWIND),
+	[HID_CONSUMER_SCAN_NEXT_TRK] = HID_CC(1, HID_CC_RPT_BUTTON_BITS, HID_CC_RPT_SCAN_NEXT_TRK),
+	[HID_CONSUMER_SCAN_PREV_TRK] = HID_CC(1, HID_CC_RPT_BUTTON_BITS, HID_CC_RPT_SCAN_PREV_TRK),
+	[HID_CONSUMER_STOP]          = HID_CC(1, HID_CC_RPT_BUTTON_BITS, HID_CC_RPT_STOP),
+};
+
+// sets cmd's field and keeps the others, so held usages build one report
 void hid_consumer_build_report(uint8_t *buffer, consumer_cmd_t cmd)
 {
 	if (!buffer) {
 		ESP_LOGE(HID_LE_PRF_TAG, "%s(), the buffer is NULL, hid build report failed.", __func__);
 		return;
 	}
-
-	switch (cmd) {
-	case HID_CONSUMER_CHANNEL_UP:
-		HID_CC_RPT_SET_CHANNEL(buffer, HID_CC_RPT_CHANNEL_UP);
-		break;
-
-	case HID_CONSUMER_CHANNEL_DOWN:
-		HID_CC_RPT_SET_CHANNEL(buffer, HID_CC_RPT_CHANNEL_DOWN);
-		break;
-
-	case HID_CONSUMER_VOLUME_UP:
-		HID_CC_RPT_SET_VOLUME_UP(buffer);
-		break;
-
-	case HID_CONSUMER_VOLUME_DOWN:
-		HID_CC_RPT_SET_VOLUME_DOWN(buffer);
-		break;
-
-	case HID_CONSUMER_MUTE:
-		HID_CC_RPT_SET_BUTTON(buffer, HID_CC_RPT_MUTE);
-		break;
-
-	case HID_CONSUMER_POWER:
-		HID_CC_RPT_SET_BUTTON(buffer, HID_CC_RPT_POWER);
-		break;
-
-	case HID_CONSUMER_RECALL_LAST:
-		HID_CC_RPT_SET_BUTTON(buffer, HID_CC_RPT_LAST);
-		break;
-
-	case HID_CONSUMER_ASSIGN_SEL:
-		HID_CC_RPT_SET_BUTTON(buffer, HID_CC_RPT_ASSIGN_SEL);
-		break;
-
-	case HID_CONSUMER_PLAY:
-		HID_CC_RPT_SET_BUTTON(buffer, HID_CC_RPT_PLAY);
-		break;
-
-	case HID_CONSUMER_PAUSE:
-		HID_CC_RPT_SET_BUTTON(buffer, HID_CC_RPT_PAUSE);
-		break;
-
-	case HID_CONSUMER_RECORD:
-		HID_CC_RPT_SET_BUTTON(buffer, HID_CC_RPT_RECORD);
-		break;
-
-	case HID_CONSUMER_FAST_FORWARD:
-		HID_CC_RPT_SET_BUTTON(buffer, HID_CC_RPT_FAST_FWD);
-		break;
-
-	case HID_CONSUMER_REWIND:
-		HID_CC_RPT_SET_BUTTON(buffer, HID_CC_RPT_REWIND);
-		break;
-
-	case HID_CONSUMER_SCAN_NEXT_TRK:
-		HID_CC_RPT_SET_BUTTON(buffer, HID_CC_RPT_SCAN_NEXT_TRK);
-		break;
-
-	case HID_CONSUMER_SCAN_PREV_TRK:
-		HID_CC_RPT_SET_BUTTON(buffer, HID_CC_RPT_SCAN_PREV_TRK);
-		break;
-
-	case HID_CONSUMER_STOP:
-		HID_CC_RPT_SET_BUTTON(buffer, HID_CC_RPT_STOP);
-		break;
-
-	default:
-		break;
+	if (hid_cc_fields[cmd].set) {
+		buffer[hid_cc_fields[cmd].byte] &= hid_cc_fields[cmd].keep;
+		buffer[hid_cc_fields[cmd].byte] |= hid_cc_fields[cmd].set;
 	}
-
-	return;
 }
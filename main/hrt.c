@@ -0,0 +1,120 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include "esp_attr.h"
+#include "esp_log.h"
+#include "esp_rom_sys.h"
+#include "hrt.h"
+
+static const char *TAG = "hrt";
+
+static void IRAM_ATTR wake(void *arg)
+{
+	Pacer *p = arg;
+	BaseType_t yield = pdFALSE;
+
+	vTaskNotifyGiveIndexedFromISR(p->task, HRT_NOTIFY, &yield);
+	// esp_timer switches once all callbacks due now have run
+	if (yield) {
+		esp_timer_isr_dispatch_need_yield();
+	}
+}
+
+// the pacer belongs to the calling task
+esp_err_t pacer_init(Pacer *p, const char *name)
+{
+	esp_timer_create_args_t args = {
+		.callback = wake,
+		.arg = p,
+		.dispatch_method = ESP_TIMER_ISR,
+		.name = name,
+	};
+
+	p->task = xTaskGetCurrentTaskHandle();
+	p->next = 0;
+	return esp_timer_create(&args, &p->timer);
+}
+
+void pacer_until(Pacer *p, int64_t deadline)
+{
+	int64_t left = deadline - esp_timer_get_time();
+	esp_err_t ret;
+
+	if (left <= 0) {
+		return;
+	}
+	if (left > HRT_SPIN_US) {
+		ulTaskNotifyTakeIndexed(HRT_NOTIFY, pdTRUE, 0);
+		// still armed from a wait that timed out before it fired
+		if ((ret = esp_timer_start_once(p->timer, left - HRT_SPIN_US/2)) == ESP_ERR_INVALID_STATE) {
+			esp_timer_stop(p->timer);
+			ret = esp_timer_start_once(p->timer, left - HRT_SPIN_US/2);
+		}
+		if (ret == ESP_OK) {
+			if (!ulTaskNotifyTakeIndexed(HRT_NOTIFY, pdTRUE, pdMS_TO_TICKS(left/1000) + 2)) {
+				esp_timer_stop(p->timer);
+			}
+		} else {
+			// no timer: sleep the whole ticks and spin the rest
+			vTaskDelay(pdMS_TO_TICKS((left - HRT_SPIN_US)/1000));
+		}
+	}
+	// finish the last few microseconds without a context switch
+	while ((left = deadline - esp_timer_get_time()) > 0) {
+		esp_rom_delay_us(left);
+	}
+}
+
+void pacer_sleep(Pacer *p, uint32_t us)
+{
+	pacer_until(p, esp_timer_get_time() + us);
+}
+
+// fixed-rate loop: deadlines advance by us regardless of work done
+void pacer_period(Pacer *p, uint32_t us)
+{
+	int64_t now = esp_timer_get_time();
+
+	if (p->next == 0 || p->next + us < now) {
+		p->next = now;
+	}
+	p->next += us;
+	pacer_until(p, p->next);
+}
+
+static void measure(Pacer *p, uint32_t us, bool tick, int64_t *mean, int64_t *worst)
+{
+	int64_t t, err;
+	int i;
+
+	*mean = *worst = 0;
+	for (i = 0; i < 8; i++) {
+		t = esp_timer_get_time();
+		if (tick) {
+			vTaskDelay(pdMS_TO_TICKS(us/1000));
+		} else {
+			pacer_sleep(p, us);
+		}
+		err = esp_timer_get_time() - t - us;
+		*mean += err;
+		if (llabs(err) > llabs(*worst)) {
+			*worst = err;
+		}
+	}
+	*mean /= 8;
+}
+
+// logs how far each method lands from the requested delay
+void hrt_compare(Pacer *p)
+{
+	static const uint32_t delays[] = { 500, 2000, 5000, 10000, 20000 };
+	int64_t mean[2], worst[2];
+	int i;
+
+	for (i = 0; i < sizeof(delays)/sizeof(*delays); i++) {
+		measure(p, delays[i], true, &mean[0], &worst[0]);
+		measure(p, delays[i], false, &mean[1], &worst[1]);
+		ESP_LOGI(TAG, "%5lu us: tick error mean %lld worst %lld, esp_timer error mean %lld worst %lld",
+			(unsigned long)delays[i], mean[0], worst[0], mean[1], worst[1]);
+	}
+}
@@ -0,0 +1,26 @@
+#include <stdint.h>
+#include "esp_err.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+/*
+ * High resolution sleeps on esp_timer.  CONFIG_FREERTOS_HZ=100 rounds
+ * every vTaskDelay to 10 ms; a Pacer wakes its task from the timer ISR
+ * instead.  It uses notification index 1 so it does not consume the
+ * default index tasks use for their own wakeups.
+ */
+#define HRT_NOTIFY                   1
+#define HRT_SPIN_US                 50
+
+typedef struct {
+	esp_timer_handle_t timer;
+	TaskHandle_t task;
+	int64_t next;
+} Pacer;
+
+esp_err_t pacer_init(Pacer *p, const char *name);
+void pacer_sleep(Pacer *p, uint32_t us);
+void pacer_until(Pacer *p, int64_t deadline);
+void pacer_period(Pacer *p, uint32_t us);
+void hrt_compare(Pacer *p);
@@ -0,0 +1,165 @@
+#include <stdint.h>
+#include <stdatomic.h>
+#include <string.h>
+#include "esp_log.h"
+#include "nvs.h"
+#include "keymap.h"
+#include "usage.h"
+
+static const char *TAG = "keymap";
+
+static const Key qwerty[] = {
+	{ '0',  HID_KEY_0,                },
+	{ 'p',  HID_KEY_P,                },
+	{ ';',  HID_KEY_SEMI_COLON,       },
+	{ '/',  HID_KEY_FWD_SLASH,        },
+	{ '9',  HID_KEY_9,                },
+	{ 'o',  HID_KEY_O,                },
+	{ 'l',  HID_KEY_L,                },
+	{ '.',  HID_KEY_DOT,              },
+	{ '8',  HID_KEY_8,                },
+	{ 'i',  HID_KEY_I,                },
+	{ 'k',  HID_KEY_K,                },
+	{ ',',  HID_KEY_COMMA,            },
+	{ '7',  HID_KEY_7,                },
+	{ 'u',  HID_KEY_U,                },
+	{ 'j',  HID_KEY_J,                },
+	{ 'm',  HID_KEY_M,                },
+	{ '6',  HID_KEY_6,                },
+	{ 'y',  HID_KEY_Y,                },
+	{ 'h',  HID_KEY_H,                },
+	{ 'n',  HID_KEY_N,                },
+	{ '5',  HID_KEY_5,                },
+	{ 't',  HID_KEY_T,                },
+	{ 'g',  HID_KEY_G,                },
+	{ 'b',  HID_KEY_B,                },
+	{ '4',  HID_KEY_4,                },
+	{ 'r',  HID_KEY_R,                },
+	{ 'f',  HID_KEY_F,                },
+	{ 'v',  HID_KEY_V,                },
+	{ '3',  HID_KEY_3,                },
+	{ 'e',  HID_KEY_E,                },
+	{ 'd',  HID_KEY_D,                },
+	{ 'c',  HID_KEY_C,                },
+	{ '2',  HID_KEY_2,                },
+	{ 'w',  HID_KEY_W,                },
+	{ 's',  HID_KEY_S,                },
+	{ 'x',  HID_KEY_X,                },
+	{ '1',  HID_KEY_1,                },
+	{ 'q',  HID_KEY_Q,                },
+	{ 'a',  HID_KEY_A,                },
+	{ 'z',  HID_KEY_Z,                },
+	{ '`',  HID_KEY_GRV_ACCENT,       },
+	{ '\t', HID_KEY_TAB,              },
+	[KEYMAP_GESTURE+0] = { '>', HID_KEY_SPACEBAR, },
+	[KEYMAP_GESTURE+1] = { '<', HID_KEY_DELETE,   },
+};
+
+/*
+ * Readers copy their entry out of the active table; a new table is filled
+ * into the idle buffer and published with a single store, so the
+ * detection task never waits on an upload.  A reader that loaded the
+ * table just before a swap may still be copying from it, so each buffer
+ * counts its readers and an upload refuses a buffer that has any.
+ */
+static Key tables[2][KEYMAP_LEN];
+static _Atomic(Key *) active = tables[0];
+static _Atomic int readers[2];
+
+// blob: <version> then <ch><hid><act> per entry
+static int parse(Key *dst, const uint8_t *blob, size_t len)
+{
+	size_t i;
+
+	if (len < 1 || blob[0] != KEYMAP_VERSION || (len-1) % 3 || (len-1)/3 > KEYMAP_LEN) {
+		return -1;
+	}
+	memset(dst, 0, sizeof(Key)*KEYMAP_LEN);
+	for (i = 1; i < len; i += 3, dst++) {
+		dst->ch = blob[i];
+		dst->hid = blob[i+1];
+		dst->act = blob[i+2];
+	}
+	return 0;
+}
+
+static Key *idle(void)
+{
+	return atomic_load(&active) == tables[0] ? tables[1] : tables[0];
+}
+
+Key keymap_key(int idx)
+{
+	Key *t, k;
+
+	for (;;) {
+		t = atomic_load(&active);
+		atomic_fetch_add(&readers[t == tables[1]], 1);
+		// the swap went past us, the count may have come too late
+		if (atomic_load(&active) == t) {
+			break;
+		}
+		atomic_fetch_sub(&readers[t == tables[1]], 1);
+	}
+	k = t[idx % KEYMAP_LEN];
+	atomic_fetch_sub(&readers[t == tables[1]], 1);
+	return k;
+}
+
+esp_err_t keymap_load(void)
+{
+	nvs_handle_t nvs;
+	uint8_t blob[1+KEYMAP_LEN*3];
+	size_t len = sizeof(blob);
+	esp_err_t ret;
+	Key *t;
+
+	memcpy(tables[0], qwerty, sizeof(qwerty));
+	atomic_store(&active, tables[0]);
+
+	if ((ret = nvs_open("lask", NVS_READONLY, &nvs)) != ESP_OK) {
+		return ret;
+	}
+	ret = nvs_get_blob(nvs, "keymap", blob, &len);
+	nvs_close(nvs);
+	if (ret != ESP_OK) {
+		return ret;
+	}
+
+	t = idle();
+	if (parse(t, blob, len)) {
+		ESP_LOGE(TAG, "stored keymap rejected, using defaults");
+		return ESP_ERR_INVALID_VERSION;
+	}
+	atomic_store(&active, t);
+	ESP_LOGI(TAG, "loaded %d entries", (int)(len-1)/3);
+	return ESP_OK;
+}
+
+esp_err_t keymap_store(const uint8_t *blob, size_t len)
+{
+	nvs_handle_t nvs;
+	esp_err_t ret;
+	Key *t = idle();
+
+	if (atomic_load(&readers[t == tables[1]])) {
+		return ESP_ERR_INVALID_STATE;
+	}
+	if (parse(t, blob, len)) {
+		return ESP_ERR_INVALID_ARG;
+	}
+
+	if ((ret = nvs_open("lask", NVS_READWRITE, &nvs)) != ESP_OK) {
+		return ret;
+	}
+	if ((ret = nvs_set_blob(nvs, "keymap", blob, len)) == ESP_OK) {
+		ret = nvs_commit(nvs);
+	}
+	nvs_close(nvs);
+	if (ret != ESP_OK) {
+		return ret;
+	}
+
+	atomic_store(&active, t);
+	return ESP_OK;
+}
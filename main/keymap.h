@@ -0,0 +1,25 @@
+#include <stdint.h>
+#include <stddef.h>
+#include "esp_err.h"
+
+#define KEYMAP_LEN                  48
+#define KEYMAP_VERSION               1
+#define KEYMAP_GESTURE              44	// one entry per gesture template from here
+
+enum {
+	ACT_KEY,
+	ACT_MACRO,
+	ACT_HOST,	// make host slot hid the output
+	ACT_SCROLL,	// toggle the stick between pointer and wheel/pan
+	ACT_CONSUMER,	// hid is a consumer usage, HID_CONSUMER_*
+};
+
+typedef struct {
+	int ch;
+	uint8_t hid;	// HID usage, or the argument of act
+	uint8_t act;
+} Key;
+
+esp_err_t keymap_load(void);
+esp_err_t keymap_store(const uint8_t *blob, size_t len);
+Key keymap_key(int idx);
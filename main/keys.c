@@ -0,0 +1,98 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include "keymap.h"
+#include "report.h"
+#include "ring.h"
+#include "usage.h"
+#include "keys.h"
+
+#define LENGTH(x)  ((int)(sizeof (x) / sizeof *(x)))
+#define MIN(a, b)  ((a) > (b) ? (b) : (a))
+
+void keys_init(Keys *k, keys_queue_t queue, keys_media_t build, uint8_t len)
+{
+	memset(k, 0, sizeof(*k));
+	k->queue = queue;
+	k->build = build;
+	k->len = len;
+}
+
+// adds or removes code, false if that changes nothing
+static bool hold(uint8_t *set, int *n, int max, uint8_t code, bool press)
+{
+	int i;
+
+	for (i = 0; i < *n && set[i] != code; i++);
+	if (press) {
+		if (i < *n || *n >= max) {
+			return false;
+		}
+		set[(*n)++] = code;
+	} else {
+		if (i == *n) {
+			return false;
+		}
+		memmove(&set[i], &set[i+1], *n-i-1);
+		(*n)--;
+	}
+	return true;
+}
+
+int keys_send(Keys *k, uint32_t us, uint8_t mods, const uint8_t *keys, uint8_t n)
+{
+	Report r = { .us = us, .id = HID_RPT_ID_KEY_IN, .len = 8 };
+
+	r.data[0] = mods;
+	memcpy(&r.data[2], keys, MIN(n, KEYS_HELD));
+	return k->queue(&r);
+}
+
+static int media(Keys *k, uint32_t us)
+{
+	Report r = { .us = us, .id = HID_RPT_ID_CC_IN, .len = k->len };
+	int i;
+
+	for (i = 0; i < k->nmedia; i++) {
+		k->build(r.data, k->media[i]);
+	}
+	return k->queue(&r);
+}
+
+// false for events that are not a key, or a consumer usage with no way to build one
+bool keys_event(Keys *k, const Event *ev)
+{
+	switch (ev->act) {
+	case ACT_KEY:
+		if (hold(k->held, &k->n, LENGTH(k->held), ev->code, ev->flags & EV_PRESS)) {
+			keys_send(k, ev->us, 0, k->held, k->n);
+		}
+		return true;
+	case ACT_CONSUMER:
+		if (!k->build) {
+			return false;
+		}
+		if (hold(k->media, &k->nmedia, LENGTH(k->media), ev->code, ev->flags & EV_PRESS)) {
+			media(k, ev->us);
+		}
+		return true;
+	}
+	return false;
+}
+
+// lets go of everything on the host
+void keys_release(Keys *k, uint32_t us)
+{
+	k->n = 0;
+	keys_send(k, us, 0, k->held, 0);
+	if (k->nmedia) {
+		k->nmedia = 0;
+		media(k, us);
+	}
+}
+
+// the host is gone and holds nothing
+void keys_forget(Keys *k)
+{
+	k->n = k->nmedia = 0;
+}
@@ -0,0 +1,34 @@
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+ * What the host holds down, and the reports that change it.  The sender
+ * and host/replay both turn key and consumer events into reports here.
+ * queue waits for room behind what is already queued, so the reports
+ * keep their order.
+ */
+#define KEYS_HELD                    6	// keys in a keyboard report
+#define KEYS_MEDIA                   4	// consumer usages held at once
+
+struct Event;
+struct Report;
+
+typedef int (*keys_queue_t)(const struct Report *r);
+// sets usage in a consumer report, keys_init's len bytes long
+typedef void (*keys_media_t)(uint8_t *data, uint8_t usage);
+
+typedef struct {
+	uint8_t held[KEYS_HELD];
+	int n;
+	uint8_t media[KEYS_MEDIA];
+	int nmedia;
+	keys_queue_t queue;
+	keys_media_t build;
+	uint8_t len;
+} Keys;
+
+void keys_init(Keys *k, keys_queue_t queue, keys_media_t build, uint8_t len);
+bool keys_event(Keys *k, const struct Event *ev);
+int keys_send(Keys *k, uint32_t us, uint8_t mods, const uint8_t *keys, uint8_t n);
+void keys_release(Keys *k, uint32_t us);
+void keys_forget(Keys *k);
@@ -0,0 +1,297 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <stdatomic.h>
+#include "esp_log.h"
+#include "nvs.h"
+#include "macro.h"
+#include "usage.h"
+
+#define LENGTH(x)  ((int)(sizeof (x) / sizeof *(x)))
+#define S(x)       ((x) | 0x80)
+
+static const char *TAG = "macro";
+
+/* US layout; the high bit requests shift */
+static const uint8_t ascii[128] = {
+	['\b'] = HID_KEY_DELETE,     ['\t'] = HID_KEY_TAB,           ['\n'] = HID_KEY_RETURN,
+	[' ']  = HID_KEY_SPACEBAR,   ['!']  = S(HID_KEY_1),          ['"']  = S(HID_KEY_SGL_QUOTE),
+	['#']  = S(HID_KEY_3),       ['$']  = S(HID_KEY_4),          ['%']  = S(HID_KEY_5),
+	['&']  = S(HID_KEY_7),       ['\''] = HID_KEY_SGL_QUOTE,     ['(']  = S(HID_KEY_9),
+	[')']  = S(HID_KEY_0),       ['*']  = S(HID_KEY_8),          ['+']  = S(HID_KEY_EQUAL),
+	[',']  = HID_KEY_COMMA,      ['-']  = HID_KEY_MINUS,         ['.']  = HID_KEY_DOT,
+	['/']  = HID_KEY_FWD_SLASH,  ['0']  = HID_KEY_0,             ['1']  = HID_KEY_1,
+	['2']  = HID_KEY_2,          ['3']  = HID_KEY_3,             ['4']  = HID_KEY_4,
+	['5']  = HID_KEY_5,          ['6']  = HID_KEY_6,             ['7']  = HID_KEY_7,
+	['8']  = HID_KEY_8,          ['9']  = HID_KEY_9,             [':']  = S(HID_KEY_SEMI_COLON),
+	[';']  = HID_KEY_SEMI_COLON, ['<']  = S(HID_KEY_COMMA),      ['=']  = HID_KEY_EQUAL,
+	['>']  = S(HID_KEY_DOT),     ['?']  = S(HID_KEY_FWD_SLASH),  ['@']  = S(HID_KEY_2),
+	['A']  = S(HID_KEY_A),       ['B']  = S(HID_KEY_B),          ['C']  = S(HID_KEY_C),
+	['D']  = S(HID_KEY_D),       ['E']  = S(HID_KEY_E),          ['F']  = S(HID_KEY_F),
+	['G']  = S(HID_KEY_G),       ['H']  = S(HID_KEY_H),          ['I']  = S(HID_KEY_I),
+	['J']  = S(HID_KEY_J),       ['K']  = S(HID_KEY_K),          ['L']  = S(HID_KEY_L),
+	['M']  = S(HID_KEY_M),       ['N']  = S(HID_KEY_N),          ['O']  = S(HID_KEY_O),
+	['P']  = S(HID_KEY_P),       ['Q']  = S(HID_KEY_Q),          ['R']  = S(HID_KEY_R),
+	['S']  = S(HID_KEY_S),       ['T']  = S(HID_KEY_T),          ['U']  = S(HID_KEY_U),
+	['V']  = S(HID_KEY_V),       ['W']  = S(HID_KEY_W),          ['X']  = S(HID_KEY_X),
+	['Y']  = S(HID_KEY_Y),       ['Z']  = S(HID_KEY_Z),          ['[']  = HID_KEY_LEFT_BRKT,
+	['\\'] = HID_KEY_BACK_SLASH, [']']  = HID_KEY_RIGHT_BRKT,    ['^']  = S(HID_KEY_6),
+	['_']  = S(HID_KEY_MINUS),   ['`']  = HID_KEY_GRV_ACCENT,    ['a']  = HID_KEY_A,
+	['b']  = HID_KEY_B,          ['c']  = HID_KEY_C,             ['d']  = HID_KEY_D,
+	['e']  = HID_KEY_E,          ['f']  = HID_KEY_F,             ['g']  = HID_KEY_G,
+	['h']  = HID_KEY_H,          ['i']  = HID_KEY_I,             ['j']  = HID_KEY_J,
+	['k']  = HID_KEY_K,          ['l']  = HID_KEY_L,             ['m']  = HID_KEY_M,
+	['n']  = HID_KEY_N,          ['o']  = HID_KEY_O,             ['p']  = HID_KEY_P,
+	['q']  = HID_KEY_Q,          ['r']  = HID_KEY_R,             ['s']  = HID_KEY_S,
+	['t']  = HID_KEY_T,          ['u']  = HID_KEY_U,             ['v']  = HID_KEY_V,
+	['w']  = HID_KEY_W,          ['x']  = HID_KEY_X,             ['y']  = HID_KEY_Y,
+	['z']  = HID_KEY_Z,          ['{']  = S(HID_KEY_LEFT_BRKT),  ['|']  = S(HID_KEY_BACK_SLASH),
+	['}']  = S(HID_KEY_RIGHT_BRKT), ['~'] = S(HID_KEY_GRV_ACCENT),
+};
+
+// records are stored back to back as <len><bytes...>
+typedef struct {
+	uint8_t buf[MACRO_BUF_LEN];
+	uint16_t offset[MACRO_MAX];
+	uint8_t length[MACRO_MAX];
+	int n;
+} Table;
+
+/*
+ * Same double-buffering as the keymap: uploads fill the idle table.  A
+ * macro plays from its table across waits, so the table it started on
+ * counts it as a reader until it ends, and an upload that would refill
+ * that table is refused instead.
+ */
+static Table tables[2];
+static _Atomic(Table *) active = &tables[0];
+static _Atomic int readers[2];
+
+typedef struct {
+	uint8_t mods;
+	uint8_t held[6];
+	uint8_t nheld;
+	uint8_t typed;
+	macro_emit_t emit;
+} Typing;
+
+static int parse(Table *t, const uint8_t *blob, size_t len)
+{
+	size_t i;
+
+	if (len > sizeof(t->buf)) {
+		return -1;
+	}
+	t->n = 0;
+	for (i = 0; i < len; i += blob[i] + 1) {
+		if (t->n >= MACRO_MAX || i + 1 + blob[i] > len) {
+			return -1;
+		}
+		t->offset[t->n] = i + 1;
+		t->length[t->n] = blob[i];
+		t->n++;
+	}
+	memmove(t->buf, blob, len);
+	return 0;
+}
+
+static Table *idle(void)
+{
+	return atomic_load(&active) == &tables[0] ? &tables[1] : &tables[0];
+}
+
+static int flush(Typing *r)
+{
+	uint8_t keys[6];
+	uint8_t n = r->nheld;
+
+	memcpy(keys, r->held, n);
+	if (r->typed && n < LENGTH(r->held)) {
+		keys[n++] = r->typed;
+	}
+	return r->emit(r->mods, keys, n);
+}
+
+/*
+ * A typed key is released implicitly by the report that presses the next
+ * one, so text costs one report per character.  Only repeats and shift
+ * changes need an intermediate report.
+ */
+static int type(Typing *r, uint8_t held_mods, uint8_t c)
+{
+	uint8_t u = c & 0x7f;
+	uint8_t mods = held_mods | ((c & 0x80) ? LEFT_SHIFT_KEY_MASK : 0);
+
+	if (u == 0) {
+		return 0;
+	}
+	if (r->typed == u || r->mods != mods) {
+		r->typed = 0;
+		r->mods = mods;
+		if (flush(r)) {
+			return -1;
+		}
+	}
+	r->typed = u;
+	return flush(r);
+}
+
+static int hold(Typing *r, uint8_t u, bool down)
+{
+	int i;
+
+	r->typed = 0;
+	for (i = 0; i < r->nheld && r->held[i] != u; i++);
+	if (down && i == r->nheld && r->nheld < LENGTH(r->held)) {
+		r->held[r->nheld++] = u;
+	} else if (!down && i < r->nheld) {
+		memmove(&r->held[i], &r->held[i+1], r->nheld-i-1);
+		r->nheld--;
+	}
+	return flush(r);
+}
+
+int macro_count(void)
+{
+	return atomic_load(&active)->n;
+}
+
+static Table *acquire(void)
+{
+	Table *t;
+
+	for (;;) {
+		t = atomic_load(&active);
+		atomic_fetch_add(&readers[t - tables], 1);
+		// the swap went past us, the count may have come too late
+		if (atomic_load(&active) == t) {
+			return t;
+		}
+		atomic_fetch_sub(&readers[t - tables], 1);
+	}
+}
+
+static void release(const Table *t)
+{
+	atomic_fetch_sub(&readers[t - tables], 1);
+}
+
+static int play(const Table *t, int idx, macro_emit_t emit, macro_wait_t wait)
+{
+	const uint8_t *p, *end;
+	uint8_t c, arg, mods = 0;
+	int ret = 0;
+	Typing r = { .emit = emit };
+
+	if (idx < 0 || idx >= t->n) {
+		ESP_LOGW(TAG, "no macro %d", idx);
+		return -1;
+	}
+
+	p = &t->buf[t->offset[idx]];
+	end = p + t->length[idx];
+	while (ret == 0 && p < end && (c = *p++) != MACRO_END) {
+		if (c > MACRO_WAIT) {
+			ret = type(&r, mods, c < LENGTH(ascii) ? ascii[c] : 0);
+			continue;
+		}
+		if (p >= end) {
+			break;
+		}
+		arg = *p++;
+		switch (c) {
+		case MACRO_MOD:
+			mods = arg;
+			r.typed = 0;
+			r.mods = mods;
+			ret = flush(&r);
+			break;
+		case MACRO_TAP:
+			if ((ret = hold(&r, arg, true)) == 0) {
+				ret = hold(&r, arg, false);
+			}
+			break;
+		case MACRO_DOWN:
+		case MACRO_UP:
+			ret = hold(&r, arg, c == MACRO_DOWN);
+			break;
+		case MACRO_WAIT:
+			if (r.typed) {
+				r.typed = 0;
+				ret = flush(&r);
+			}
+			wait(arg * 10);
+			break;
+		}
+	}
+
+	if (ret) {
+		return ret;
+	}
+	memset(&r.held, 0, sizeof(r.held));
+	r.nheld = r.typed = r.mods = 0;
+	return flush(&r);
+}
+
+int macro_play(int idx, macro_emit_t emit, macro_wait_t wait)
+{
+	Table *t = acquire();
+	int ret;
+
+	ret = play(t, idx, emit, wait);
+	release(t);
+	return ret;
+}
+
+esp_err_t macro_load(void)
+{
+	nvs_handle_t nvs;
+	Table *t = idle();
+	size_t len = sizeof(t->buf);
+	esp_err_t ret;
+
+	if ((ret = nvs_open("lask", NVS_READONLY, &nvs)) != ESP_OK) {
+		return ret;
+	}
+	ret = nvs_get_blob(nvs, "macros", t->buf, &len);
+	nvs_close(nvs);
+	if (ret != ESP_OK) {
+		return ret;
+	}
+
+	if (parse(t, t->buf, len)) {
+		ESP_LOGE(TAG, "corrupt macro table");
+		return ESP_ERR_INVALID_SIZE;
+	}
+	atomic_store(&active, t);
+	ESP_LOGI(TAG, "loaded %d macros, %d bytes", t->n, (int)len);
+	return ESP_OK;
+}
+
+esp_err_t macro_store(const uint8_t *blob, size_t len)
+{
+	nvs_handle_t nvs;
+	esp_err_t ret;
+	Table *t = idle();
+
+	if (atomic_load(&readers[t - tables])) {
+		return ESP_ERR_INVALID_STATE;
+	}
+	if (parse(t, blob, len)) {
+		return ESP_ERR_INVALID_SIZE;
+	}
+
+	if ((ret = nvs_open("lask", NVS_READWRITE, &nvs)) != ESP_OK) {
+		return ret;
+	}
+	if ((ret = nvs_set_blob(nvs, "macros", blob, len)) == ESP_OK) {
+		ret = nvs_commit(nvs);
+	}
+	nvs_close(nvs);
+	if (ret != ESP_OK) {
+		return ret;
+	}
+
+	atomic_store(&active, t);
+	return ESP_OK;
+}
@@ -0,0 +1,27 @@
+#include <stdint.h>
+#include <stddef.h>
+#include "esp_err.h"
+
+#define MACRO_MAX                   32
+#define MACRO_BUF_LEN             1024
+
+/*
+ * Macros are byte strings.  Printable ASCII, '\b', '\t' and '\n' are typed
+ * as text; the bytes below are opcodes taking one argument byte.
+ */
+enum {
+	MACRO_END,
+	MACRO_MOD,	// hold modifier mask (0 releases)
+	MACRO_TAP,	// tap raw HID usage
+	MACRO_DOWN,	// press raw HID usage
+	MACRO_UP,	// release raw HID usage
+	MACRO_WAIT,	// flush, then pause arg*10 ms
+};
+
+typedef int (*macro_emit_t)(uint8_t mods, uint8_t *keys, uint8_t n);
+typedef void (*macro_wait_t)(int ms);
+
+esp_err_t macro_load(void);
+esp_err_t macro_store(const uint8_t *blob, size_t len);
+int macro_count(void);
+int macro_play(int idx, macro_emit_t emit, macro_wait_t wait);
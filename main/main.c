@@ -1,11 +1,16 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdatomic.h>
 #include <math.h>
 
+#include "driver/gpio.h"
 #include "driver/i2c_master.h"
+#include "esp_adc/adc_cali.h"
+#include "esp_adc/adc_cali_scheme.h"
 #include "esp_adc/adc_continuous.h"
 #include "esp_bt_defs.h"
+#include "esp_cpu.h"
 #include "esp_bt_device.h"
 #include "esp_bt.h"
 #include "esp_bt_main.h"
@@ -14,41 +19,177 @@
 #include "esp_lcd_panel_ops.h"
 #include "esp_lcd_panel_vendor.h"
 #include "esp_log.h"
+#include "esp_random.h"
 #include "esp_system.h"
+#include "esp_timer.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 #include "freertos/queue.h"
 #include "nvs_flash.h"
 
 #include "hid.h"
+#include "adv.h"
+#include "battery.h"
+#include "bus.h"
+#include "cfg.h"
+#include "conn.h"
+#include "detect.h"
+#include "espnow.h"
+#include "gesture.h"
+#include "hrt.h"
+#include "keymap.h"
+#include "keys.h"
+#include "macro.h"
+#include "output.h"
+#include "pointer.h"
+#include "prof.h"
+#include "report.h"
+#include "ring.h"
+#include "role.h"
+#include "split.h"
+#include "state.h"
+#include "usage.h"
+#include "usb.h"
 
 #define LENGTH(x)  ((int)(sizeof (x) / sizeof *(x)))
 #define MIN(a, b)  ((a) > (b) ? (b) : (a))
 #define MAX(a, b)  ((a) < (b) ? (b) : (a))
+#define CLAMP(x, lo, hi)  ((x) < (lo) ? (lo) : (x) > (hi) ? (hi) : (x))
 
 #define W                          128
 #define H                           32
 
-typedef struct {
-	int ch;
-	uint8_t hid;
-} Key;
+#define SEND_RETRIES                50
+#define SEND_RETRY_US             1000
+#define SWITCH_DRAIN                20	// 10ms waits for the old host to ack releases
+#define DRAW_PERIOD_US           20000
+#define MOUSE_INTERVAL_US         7500	// until the link's interval is known
+#define SCROLL_COUNTS               24	// pointer counts per wheel detent
+#define TRACE                        0	// print sensing frames for host/replay
+#define PACER_BENCH                  0	// compare pacer and tick sleeps at boot, about 600 ms
+#define BOOT_BUTTON                  0	// a strapping pin, so only read once the firmware runs
+#define BUTTON_POLL_MS              20
+#define BUTTON_WINDOW_MS          3000	// a hold must begin this soon after starting
+#define BUTTON_PAIR_MS            1000	// let go before BUTTON_RESET_MS
+#define BUTTON_RESET_MS           5000	// forget the role records and restart
+
+/*
+ * Bluedroid and the controller are pinned to core 0, so sensing gets core 1
+ * to itself and the radio and display tasks share core 0 with the stack.
+ */
+#define CORE_SENSE                   1
+#define CORE_RADIO                   0
+#define PRIO_SENSE                  (configMAX_PRIORITIES-2)
+#define PRIO_RADIO                  10
+#define PRIO_DISPLAY                 2
+#define PRIO_APP                     5
+
+#define APP_QUEUE                   24
+#define APP_RESERVE                  8	// slots only link lifecycle events may take
+#define APP_BLOCK_MS                20	// how long a lifecycle event may hold up the stack
+#define APP_WRITE_MAX              128	// cfg chunks fit in an MTU, anything longer is refused
+
+#define LOOP_BUDGET_US            1000
 
 // lask
 static const char *TAG = "lask5";
-static bool left = 1;
+static const Role *role;
+static bool primary;	// role->primary, read by every task
+static void (*emit)(int idx, int ch);	// a settled finger position, picked with the role
 
 // interprocess-communication
-static QueueHandle_t KeyboardQueue, MouseQueue, DisplayQueue, NetworkQueue;
+static Bus telemetry;
+static Ring keyring;
+static TaskHandle_t sender = NULL;
+static _Atomic int32_t motion[2];	// stick counts the sender has not queued yet
+
+// split
+static Split split;
+static Transport espnow;
+static Ring taps, remote;	// this half's taps for the link, the other half's for the sender
+static QueueHandle_t datagrams;
+static TaskHandle_t splitter = NULL;
+static TaskHandle_t button = NULL;	// told once the link is up, or failed to come up
+static uint32_t taps_dropped;
+static _Atomic int offer = -1;	// role record for the link task to offer, side | primary << 8
+
+typedef struct {
+	uint8_t len;
+	uint8_t frame[ESPNOW_FRAME_MAX];
+} Datagram;
+static bool scrolling;	// the stick drives wheel and pan instead of the pointer
+static Keys keys;	// what the host holds, the sender's
+static Pacer radio;
+
+// jitter
+static Hist period, loop;
+static Hist gesture_time;	// in cycles
+
+// sensing
+static Gestures gestures;
 
 // display
 static esp_lcd_panel_handle_t panel = NULL;
 
 // bluetooth
+enum {
+	APP_CONNECT,
+	APP_DISCONNECT,
+	APP_SEC_REQ,
+	APP_AUTH,
+	APP_ACKED,	// first completed notification on a link
+	APP_READ,
+	APP_WRITE,
+	APP_CONN_PARAMS,
+	APP_ADV_READY,
+	APP_ADV_STOPPED,
+	APP_BATTERY,
+	APP_CONN,	// input or the idle timer, for conn_service
+};
+
+enum {
+	LINK_GONE,
+	LINK_OPEN,
+	LINK_SECURE,
+};
+
+// stack callback, copied out for the app task
+typedef struct {
+	uint8_t type;
+	uint8_t ok;
+	uint32_t us;	// when the stack called back
+	uint8_t status;	// auth failure, disconnect reason, update status or battery level
+	uint16_t conn_id;
+	esp_bd_addr_t bda;
+	union {
+		struct {
+			uint16_t interval, latency, timeout;
+		} params;
+		struct {
+			uint16_t handle;
+			uint16_t len;
+			uint8_t data[APP_WRITE_MAX];
+		} write;
+		struct {
+			uint16_t handle;
+		} read;
+	};
+} AppEvent;
+
+static QueueHandle_t events;
+static volatile uint32_t events_dropped, events_unexpected;
+static _Atomic uint32_t unacked;	// slots still waiting for their first completion
+static Hist gatts_time, gap_time;
+static Hist led_time;	// host LED write to the display showing it
 static volatile int disconnects = 0;
 static volatile uint16_t gatts_interface = ESP_GATT_IF_NONE;
-static volatile uint16_t hid_conn_id = 0;
-static volatile bool sec_conn = false;
+static volatile int host = 0;	// slot of the host receiving reports
+static const Output ble_output;
+static const Output *volatile out = &ble_output;	// where the report queue drains to
+static esp_bd_addr_t hosts[HID_MAX_APPS];	// slot addresses as stored in nvs
+static uint8_t notifying;	// slots whose host enabled battery notifications, kept with the bond
+static int64_t lost;	// when the active host dropped, until its first report is acked
+static int via;	// advertising phase it came back on
 
 static uint8_t service_id[] = {
 	0xfb, 0x34, 0x9b, 0x5f,
@@ -94,52 +235,148 @@ static adc_channel_t channels[] = {
 	ADC_CHANNEL_5,
 };
 
-const Key qwerty[] = {
-	{ '0',  HID_KEY_0,                },
-	{ 'p',  HID_KEY_P,                },
-	{ ';',  HID_KEY_SEMI_COLON,       },
-	{ '/',  HID_KEY_FWD_SLASH,        },
-	{ '9',  HID_KEY_9,                },
-	{ 'o',  HID_KEY_O,                },
-	{ 'l',  HID_KEY_L,                },
-	{ '.',  HID_KEY_DOT,              },
-	{ '8',  HID_KEY_8,                },
-	{ 'i',  HID_KEY_I,                },
-	{ 'k',  HID_KEY_K,                },
-	{ ',',  HID_KEY_COMMA,            },
-	{ '7',  HID_KEY_7,                },
-	{ 'u',  HID_KEY_U,                },
-	{ 'j',  HID_KEY_J,                },
-	{ 'm',  HID_KEY_M,                },
-	{ '6',  HID_KEY_6,                },
-	{ 'y',  HID_KEY_Y,                },
-	{ 'h',  HID_KEY_H,                },
-	{ 'n',  HID_KEY_N,                },
-	{ '5',  HID_KEY_5,                },
-	{ 't',  HID_KEY_T,                },
-	{ 'g',  HID_KEY_G,                },
-	{ 'b',  HID_KEY_B,                },
-	{ '4',  HID_KEY_4,                },
-	{ 'r',  HID_KEY_R,                },
-	{ 'f',  HID_KEY_F,                },
-	{ 'v',  HID_KEY_V,                },
-	{ '3',  HID_KEY_3,                },
-	{ 'e',  HID_KEY_E,                },
-	{ 'd',  HID_KEY_D,                },
-	{ 'c',  HID_KEY_C,                },
-	{ '2',  HID_KEY_2,                },
-	{ 'w',  HID_KEY_W,                },
-	{ 's',  HID_KEY_S,                },
-	{ 'x',  HID_KEY_X,                },
-	{ '1',  HID_KEY_1,                },
-	{ 'q',  HID_KEY_Q,                },
-	{ 'a',  HID_KEY_A,                },
-	{ 'z',  HID_KEY_Z,                },
-	{ '`',  HID_KEY_GRV_ACCENT,       },
-	{ '\t', HID_KEY_TAB,              },
-};
+#define BATTERY_CHANNEL             ADC_CHANNEL_6
+static Battery battery;
+
+// the Bluetooth host reports go to, or NULL while it is not connected and encrypted
+static hidd_clcb_t *ble_host(void)
+{
+	hidd_clcb_t *clcb = &hidd_le_env.hidd_clcb[host];
+
+	return clcb->in_use && clcb->secure ? clcb : NULL;
+}
+
+// boot hosts get the boot characteristics, only the active host's mode matters
+static void protocol(void)
+{
+	hidd_clcb_t *clcb = &hidd_le_env.hidd_clcb[host];
+
+	hid_set_protocol_mode(clcb->in_use ? clcb->proto_mode : HID_PROTOCOL_MODE_REPORT);
+}
+
+static int connections(void)
+{
+	int i, n = 0;
+
+	for (i = 0; i < HID_MAX_APPS; i++) {
+		n += hidd_le_env.hidd_clcb[i].in_use;
+	}
+	return n;
+}
+
+static void hosts_load(void)
+{
+	nvs_handle_t nvs;
+	size_t len = sizeof(hosts);
+	int i;
+
+	if (nvs_open("lask", NVS_READONLY, &nvs) != ESP_OK) {
+		return;
+	}
+	if (nvs_get_blob(nvs, "hosts", hosts, &len) != ESP_OK || len != sizeof(hosts)) {
+		memset(hosts, 0, sizeof(hosts));
+	}
+	if (nvs_get_u8(nvs, "notifying", &notifying) != ESP_OK) {
+		notifying = 0;
+	}
+	nvs_close(nvs);
+	for (i = 0; i < HID_MAX_APPS; i++) {
+		memcpy(hidd_le_env.hidd_clcb[i].remote_bda, hosts[i], ESP_BD_ADDR_LEN);
+	}
+}
+
+// remember which slot a bonded host had, so switching keys survive reboots
+static void hosts_save(void)
+{
+	nvs_handle_t nvs;
+	int i, changed = 0;
+
+	for (i = 0; i < HID_MAX_APPS; i++) {
+		if (memcmp(hosts[i], hidd_le_env.hidd_clcb[i].remote_bda, ESP_BD_ADDR_LEN)) {
+			memcpy(hosts[i], hidd_le_env.hidd_clcb[i].remote_bda, ESP_BD_ADDR_LEN);
+			// a new host has not asked for anything yet
+			notifying &= ~(1 << i);
+			changed = 1;
+		}
+	}
+	if (!changed || nvs_open("lask", NVS_READWRITE, &nvs) != ESP_OK) {
+		return;
+	}
+	if (nvs_set_blob(nvs, "hosts", hosts, sizeof(hosts)) == ESP_OK &&
+	    nvs_set_u8(nvs, "notifying", notifying) == ESP_OK) {
+		nvs_commit(nvs);
+	}
+	nvs_close(nvs);
+}
+
+// a host wrote the battery level's CCCD; bonded hosts expect it to last
+static void battery_notify(int slot, bool on)
+{
+	nvs_handle_t nvs;
+	uint8_t was = notifying;
+
+	notifying = on ? notifying | 1 << slot : notifying & ~(1 << slot);
+	if (notifying == was || nvs_open("lask", NVS_READWRITE, &nvs) != ESP_OK) {
+		return;
+	}
+	if (nvs_set_u8(nvs, "notifying", notifying) == ESP_OK) {
+		nvs_commit(nvs);
+	}
+	nvs_close(nvs);
+}
+
+// events a link's state hangs on, losing one can leave a host slot taken for good
+static bool lifecycle(uint8_t type)
+{
+	switch (type) {
+	case APP_CONNECT:
+	case APP_DISCONNECT:
+	case APP_SEC_REQ:
+	case APP_AUTH:
+	case APP_CONN_PARAMS:
+	case APP_ADV_READY:
+	case APP_ADV_STOPPED:
+		return true;
+	}
+	return false;
+}
+
+/*
+ * Routine events leave the last APP_RESERVE slots free and are dropped
+ * when only those are left.  Lifecycle events may take them, and wait a
+ * little for room when even those are gone.
+ */
+static bool post(AppEvent *ev)
+{
+	bool ok;
+
+	ev->us = esp_timer_get_time();
+	// the secondary half has no host connection to tell
+	if (!events) {
+		ok = false;
+	} else if (lifecycle(ev->type)) {
+		ok = xQueueSend(events, ev, pdMS_TO_TICKS(APP_BLOCK_MS)) == pdTRUE;
+	} else {
+		ok = uxQueueSpacesAvailable(events) > APP_RESERVE && xQueueSend(events, ev, 0) == pdTRUE;
+	}
+	if (!ok) {
+		events_dropped++;
+	}
+	return ok;
+}
 
+/*
+ * The stack callbacks run on Bluedroid's own task, so they only copy what
+ * the app task needs out of the stack's buffers and queue it.  Service
+ * setup happens once at boot and stays here, as do completions and
+ * congestion, which pace the report window.
+ */
 static void gatts_event_handler(esp_gatts_cb_event_t event, esp_gatt_if_t gatts_if, esp_ble_gatts_cb_param_t *param) {
+	int64_t t = esp_timer_get_time();
+	hidd_clcb_t *clcb;
+	AppEvent ev;
+	uint32_t bit;
+
 	switch (event) {
 	case ESP_GATTS_REG_EVT:
 		ESP_LOGI(TAG, "ESP_GATTS_REG_EVT %d", param->reg.app_id);
@@ -165,35 +402,6 @@ static void gatts_event_handler(esp_gatts_cb_event_t event, esp_gatt_if_t gatts_
 		case BATTRAY_APP_ID:
 		}
 		break;
-	case ESP_GATTS_CONF_EVT:
-		ESP_LOGI(TAG, "ESP_GATTS_CONF_EVT");
-		break;
-	case ESP_GATTS_CREATE_EVT:
-		ESP_LOGI(TAG, "ESP_GATTS_CREATE_EVT");
-		break;
-	case ESP_GATTS_CONNECT_EVT:
-		hidd_clcb_alloc(param->connect.conn_id, param->connect.remote_bda);
-		esp_ble_set_encryption(param->connect.remote_bda, ESP_BLE_SEC_ENCRYPT_NO_MITM);
-		hid_conn_id = param->connect.conn_id;
-		ESP_LOGI(TAG, "HID connection establish, conn_id = %x", param->connect.conn_id);
-		break;
-	case ESP_GATTS_DISCONNECT_EVT:
-		ESP_LOGI(TAG, "ESP_GATTS_DISCONNECT_EVT %d", disconnects++);
-		sec_conn = false;
-		esp_ble_gap_start_advertising(&advert_config);
-		hidd_clcb_dealloc(param->disconnect.conn_id);
-		break;
-	case ESP_GATTS_CLOSE_EVT:
-		ESP_LOGI(TAG, "ESP_GATTS_CLOSE_EVT");
-		break;
-	case ESP_GATTS_WRITE_EVT:
-		ESP_LOGI(TAG, "ESP_GATTS_WRITE_EVT %d", param->write.len);
-		if (param->write.handle == hidd_le_env.hidd_inst.att_tbl[HIDD_LE_IDX_REPORT_LED_OUT_VAL]) {
-			ESP_LOG_BUFFER_HEX(TAG, param->write.value, param->write.len);
-		} else if (param->write.handle == hidd_le_env.hidd_inst.att_tbl[HIDD_LE_IDX_REPORT_VENDOR_OUT_VAL]) {
-			ESP_LOG_BUFFER_HEX(TAG, param->write.value, param->write.len);
-		}
-		break;
 	case ESP_GATTS_CREAT_ATTR_TAB_EVT:
 		ESP_LOGI(TAG, "ESP_GATTS_CREAT_ATTR_TAB_EVT");
 		if (param->add_attr_tab.status != ESP_GATT_OK) {
@@ -204,6 +412,7 @@ static void gatts_event_handler(esp_gatts_cb_event_t event, esp_gatt_if_t gatts_
 			if (param->add_attr_tab.status != ESP_GATT_OK) {
 				break;
 			}
+			memcpy(hidd_le_env.hidd_inst.bas_tbl, param->add_attr_tab.handles, BAS_IDX_NB * sizeof(uint16_t));
 			incl_svc.start_hdl = param->add_attr_tab.handles[BAS_IDX_SVC];
 			incl_svc.end_hdl = incl_svc.start_hdl + BAS_IDX_NB - 1;
 			ESP_LOGI(TAG, "start added the hid service to the stack database. incl_handle = %d", incl_svc.start_hdl);
@@ -220,128 +429,437 @@ static void gatts_event_handler(esp_gatts_cb_event_t event, esp_gatt_if_t gatts_
 			esp_ble_gatts_start_service(param->add_attr_tab.handles[0]);
 		}
 		break;
-	case ESP_GATTS_READ_EVT:
-		ESP_LOGI(TAG, "ESP_GATTS_READ_EVT");
-		break;
-	case ESP_GATTS_EXEC_WRITE_EVT:
-		ESP_LOGI(TAG, "ESP_GATTS_EXEC_WRITE_EVT");
-		break;
-	case ESP_GATTS_MTU_EVT:
-		ESP_LOGI(TAG, "ESP_GATTS_MTU_EVT");
-		break;
-	case ESP_GATTS_UNREG_EVT:
-		ESP_LOGI(TAG, "ESP_GATTS_UNREG_EVT");
-		break;
-	case ESP_GATTS_ADD_INCL_SRVC_EVT:
-		ESP_LOGI(TAG, "ESP_GATTS_ADD_INCL_SRVC_EVT");
-		break;
-	case ESP_GATTS_ADD_CHAR_EVT:
-		ESP_LOGI(TAG, "ESP_GATTS_ADD_CHAR_EVT");
-		break;
-	case ESP_GATTS_ADD_CHAR_DESCR_EVT:
-		ESP_LOGI(TAG, "ESP_GATTS_ADD_CHAR_DESCR_EVT");
-		break;
-	case ESP_GATTS_DELETE_EVT:
-		ESP_LOGI(TAG, "ESP_GATTS_DELETE_EVT");
-		break;
-	case ESP_GATTS_START_EVT:
-		ESP_LOGI(TAG, "ESP_GATTS_START_EVT");
-		break;
-	case ESP_GATTS_STOP_EVT:
-		ESP_LOGI(TAG, "ESP_GATTS_STOP_EVT");
-		break;
-	case ESP_GATTS_OPEN_EVT:
-		ESP_LOGI(TAG, "ESP_GATTS_OPEN_EVT");
+	case ESP_GATTS_CONF_EVT:
+		// battery notifications never went through the report window
+		if (param->conf.handle == hidd_le_env.hidd_inst.bas_tbl[BAS_IDX_BATT_LVL_VAL]) {
+			break;
+		}
+		if ((clcb = hidd_clcb_find(param->conf.conn_id)) == NULL) {
+			break;
+		}
+		// other hosts' notifications do not hold a slot in the window
+		if (out == &ble_output && clcb == ble_host()) {
+			report_done(esp_timer_get_time());
+			xTaskNotifyGive(sender);
+		}
+		bit = 1 << (clcb - hidd_le_env.hidd_clcb);
+		if (atomic_fetch_and(&unacked, ~bit) & bit) {
+			ev.type = APP_ACKED;
+			ev.conn_id = param->conf.conn_id;
+			post(&ev);
+		}
 		break;
-	case ESP_GATTS_CANCEL_OPEN_EVT:
-		ESP_LOGI(TAG, "ESP_GATTS_CANCEL_OPEN_EVT");
+	case ESP_GATTS_CONGEST_EVT:
+		if ((clcb = hidd_clcb_find(param->congest.conn_id))) {
+			clcb->congest = param->congest.congested;
+		}
+		if (clcb && out == &ble_output && clcb == ble_host()) {
+			report_congest(param->congest.congested);
+			xTaskNotifyGive(sender);
+		}
 		break;
-	case ESP_GATTS_LISTEN_EVT:
-		ESP_LOGI(TAG, "ESP_GATTS_LISTEN_EVT");
+	case ESP_GATTS_CONNECT_EVT:
+		ev.type = APP_CONNECT;
+		ev.conn_id = param->connect.conn_id;
+		memcpy(ev.bda, param->connect.remote_bda, sizeof(esp_bd_addr_t));
+		ev.params.interval = param->connect.conn_params.interval;
+		ev.params.latency = param->connect.conn_params.latency;
+		ev.params.timeout = param->connect.conn_params.timeout;
+		post(&ev);
 		break;
-	case ESP_GATTS_CONGEST_EVT:
-		ESP_LOGI(TAG, "ESP_GATTS_CONGEST_EVT");
+	case ESP_GATTS_DISCONNECT_EVT:
+		ev.type = APP_DISCONNECT;
+		ev.conn_id = param->disconnect.conn_id;
+		ev.status = param->disconnect.reason;
+		post(&ev);
 		break;
-	case ESP_GATTS_RESPONSE_EVT:
-		ESP_LOGI(TAG, "ESP_GATTS_RESPONSE_EVT");
+	case ESP_GATTS_WRITE_EVT:
+		ev.type = APP_WRITE;
+		ev.conn_id = param->write.conn_id;
+		ev.write.handle = param->write.handle;
+		ev.write.len = param->write.len;
+		memcpy(ev.write.data, param->write.value, MIN(param->write.len, APP_WRITE_MAX));
+		// a refused cfg chunk says so, the host sends it again
+		if (!post(&ev) && ev.write.handle == hidd_le_env.hidd_inst.att_tbl[HIDD_LE_IDX_REPORT_VENDOR_OUT_VAL]) {
+			uint8_t status[2] = { ev.write.len ? ev.write.data[0] : 0, CFG_EBUSY };
+			esp_ble_gatts_set_attr_value(ev.write.handle, sizeof(status), status);
+		}
 		break;
-	case ESP_GATTS_SET_ATTR_VAL_EVT:
-		ESP_LOGI(TAG, "ESP_GATTS_SET_ATTR_VAL_EVT");
+	case ESP_GATTS_READ_EVT:
+		ev.type = APP_READ;
+		ev.conn_id = param->read.conn_id;
+		ev.read.handle = param->read.handle;
+		post(&ev);
 		break;
-	case ESP_GATTS_SEND_SERVICE_CHANGE_EVT:
-		ESP_LOGI(TAG, "ESP_GATTS_SEND_SERVICE_CHANGE_EVT");
+	default:
 		break;
 	}
+	hist_add(&gatts_time, esp_timer_get_time() - t);
 }
 
 static void gap_event_handler(esp_gap_ble_cb_event_t event, esp_ble_gap_cb_param_t *param) {
+	int64_t t = esp_timer_get_time();
+	AppEvent ev;
+
 	switch (event) {
 	case ESP_GAP_BLE_ADV_DATA_SET_COMPLETE_EVT:
-		ESP_LOGI(TAG, "ESP_GAP_BLE_ADV_DATA_SET_COMPLETE_EVT");
-		esp_ble_gap_start_advertising(&advert_config);
-		//sec_conn = false;
+		ev.type = APP_ADV_READY;
+		post(&ev);
+		break;
+	case ESP_GAP_BLE_ADV_STOP_COMPLETE_EVT:
+		ev.type = APP_ADV_STOPPED;
+		post(&ev);
 		break;
 	case ESP_GAP_BLE_SEC_REQ_EVT:
-		ESP_LOGI(TAG, "ESP_GAP_BLE_SEC_REQ_EVT");
-		for (int i = 0; i < ESP_BD_ADDR_LEN; i++) {
-			ESP_LOGD(TAG, "%x:", param->ble_security.ble_req.bd_addr[i]);
-		}
-		esp_ble_gap_security_rsp(param->ble_security.ble_req.bd_addr, true);
-		//sec_conn = false;
+		ev.type = APP_SEC_REQ;
+		memcpy(ev.bda, param->ble_security.ble_req.bd_addr, sizeof(esp_bd_addr_t));
+		post(&ev);
 		break;
 	case ESP_GAP_BLE_AUTH_CMPL_EVT:
-		ESP_LOGI(TAG, "ESP_GAP_BLE_AUTH_CMPL_EVT");
-		esp_bd_addr_t bd_addr;
-		memcpy(bd_addr, param->ble_security.auth_cmpl.bd_addr, sizeof(esp_bd_addr_t));
-		ESP_LOGI(TAG, "remote BD_ADDR: %08x%04x",
-			(bd_addr[0] << 24) + (bd_addr[1] << 16) +
-			(bd_addr[2] << 8) + bd_addr[3],
-			(bd_addr[4] << 8) + bd_addr[5]
-		);
-		ESP_LOGI(TAG, "address type = %d", param->ble_security.auth_cmpl.addr_type);
-		ESP_LOGI(TAG, "pair status = %s", param->ble_security.auth_cmpl. success ? "success" : "fail");
-		if (!param->ble_security.auth_cmpl.success) {
-			ESP_LOGE(TAG, "fail reason = 0x%x", param->ble_security.auth_cmpl.fail_reason);
-			break;
-		}
-		vTaskDelay(pdMS_TO_TICKS(50));
-		sec_conn = true;
+		ev.type = APP_AUTH;
+		memcpy(ev.bda, param->ble_security.auth_cmpl.bd_addr, sizeof(esp_bd_addr_t));
+		ev.ok = param->ble_security.auth_cmpl.success;
+		ev.status = param->ble_security.auth_cmpl.fail_reason;
+		post(&ev);
+		break;
+	case ESP_GAP_BLE_UPDATE_CONN_PARAMS_EVT:
+		ev.type = APP_CONN_PARAMS;
+		memcpy(ev.bda, param->update_conn_params.bda, sizeof(esp_bd_addr_t));
+		ev.status = param->update_conn_params.status;
+		ev.params.interval = param->update_conn_params.conn_int;
+		ev.params.latency = param->update_conn_params.latency;
+		ev.params.timeout = param->update_conn_params.timeout;
+		post(&ev);
 		break;
 	default:
-		ESP_LOGI(TAG, "ESP_GAP_UNKNOWN_EVT");
 		break;
 	}
+	hist_add(&gap_time, esp_timer_get_time() - t);
+}
+
+static int link_state(const hidd_clcb_t *clcb)
+{
+	if (clcb == NULL || !clcb->in_use) {
+		return LINK_GONE;
+	}
+	return clcb->secure ? LINK_SECURE : LINK_OPEN;
+}
+
+// keep the readable value current and tell the encrypted hosts that asked
+static void battery_publish(uint8_t level)
+{
+	uint16_t handle = hidd_le_env.hidd_inst.bas_tbl[BAS_IDX_BATT_LVL_VAL];
+	hidd_clcb_t *clcb;
+	int i;
+
+	if (!handle) {
+		return;
+	}
+	esp_ble_gatts_set_attr_value(handle, sizeof(level), &level);
+	for (i = 0; i < HID_MAX_APPS; i++) {
+		clcb = &hidd_le_env.hidd_clcb[i];
+		if (clcb->in_use && clcb->secure && notifying & 1 << i) {
+			esp_ble_gatts_send_indicate(hidd_le_env.gatt_if, clcb->conn_id, handle, sizeof(level), &level, false);
+		}
+	}
+}
+
+static void kick_conn(void)
+{
+	AppEvent ev = { .type = APP_CONN };
+
+	post(&ev);
+}
+
+/*
+ * Bluedroid answers the discovery requests itself, so reads are all the
+ * app sees; the report map and references are the ones a host with our
+ * database cached does not make.
+ */
+static bool describes_reports(uint16_t handle)
+{
+	const uint16_t *tbl = hidd_le_env.hidd_inst.att_tbl;
+
+#define REP_REF(name, id, type, len) handle == tbl[HIDD_LE_IDX_REPORT_##name##_REP_REF] ||
+	return HID_REPORTS(REP_REF) HID_LATE_REPORTS(REP_REF)
+	       handle == tbl[HIDD_LE_IDX_REPORT_MAP_VAL] || handle == tbl[HIDD_LE_IDX_REPORT_MAP_EXT_REP_REF];
+#undef REP_REF
+}
+
+static void unexpected(const AppEvent *ev, int state)
+{
+	events_unexpected++;
+	ESP_LOGW(TAG, "event %d unexpected in link state %d", ev->type, state);
+}
+
+// link state changes: GONE -connect-> OPEN -auth-> SECURE -disconnect-> GONE
+static void app_events(void *pvParameters)
+{
+	AppEvent ev;
+	hidd_clcb_t *clcb;
+	int slot, phase;
+
+	for (;;) {
+		if (xQueueReceive(events, &ev, portMAX_DELAY) != pdTRUE) {
+			continue;
+		}
+		switch (ev.type) {
+		case APP_CONNECT:
+			phase = adv_connected();
+			if (link_state(hidd_clcb_find(ev.conn_id)) != LINK_GONE) {
+				unexpected(&ev, link_state(hidd_clcb_find(ev.conn_id)));
+				break;
+			}
+			if ((clcb = hidd_clcb_alloc(ev.conn_id, ev.bda)) == NULL) {
+				ESP_LOGE(TAG, "no free host slot, dropping conn_id = %x", ev.conn_id);
+				esp_ble_gap_disconnect(ev.bda);
+				break;
+			}
+			slot = clcb - hidd_le_env.hidd_clcb;
+			atomic_fetch_or(&unacked, 1 << slot);
+			esp_ble_set_encryption(ev.bda, ESP_BLE_SEC_ENCRYPT_NO_MITM);
+			if (slot == host) {
+				via = phase;
+				protocol();
+			}
+			conn_open(ev.conn_id, ev.bda, ev.params.interval, ev.params.latency, ev.params.timeout);
+			if (battery.primed) {
+				esp_ble_gatts_set_attr_value(hidd_le_env.hidd_inst.bas_tbl[BAS_IDX_BATT_LVL_VAL], 1, &battery.level);
+			}
+			ESP_LOGI(TAG, "HID connection establish, conn_id = %x, host %d", ev.conn_id, slot);
+			// keep advertising so the other hosts can reconnect
+			if (connections() < HID_MAX_APPS) {
+				adv_open();
+			}
+			break;
+		case APP_DISCONNECT:
+			ESP_LOGI(TAG, "disconnect %d, conn_id = %x, reason 0x%x", disconnects++, ev.conn_id, ev.status);
+			if ((clcb = hidd_clcb_find(ev.conn_id)) == NULL) {
+				unexpected(&ev, LINK_GONE);
+			} else {
+				state_forget(clcb - hidd_le_env.hidd_clcb);
+				if (clcb - hidd_le_env.hidd_clcb == host) {
+					if (out == &ble_output) {
+						report_congest(false);
+					}
+					lost = esp_timer_get_time();
+				}
+			}
+			hidd_clcb_dealloc(ev.conn_id);
+			conn_close(ev.conn_id);
+			// a dropped link usually means the host slept or walked off, call it back first
+			adv_reconnect(clcb ? clcb->remote_bda : NULL);
+			break;
+		case APP_SEC_REQ:
+			esp_ble_gap_security_rsp(ev.bda, true);
+			break;
+		case APP_AUTH:
+			clcb = hidd_clcb_by_bda(ev.bda);
+			if (!ev.ok) {
+				ESP_LOGE(TAG, "pairing failed, reason 0x%x", ev.status);
+				break;
+			}
+			if (link_state(clcb) != LINK_OPEN) {
+				unexpected(&ev, link_state(clcb));
+				break;
+			}
+			clcb->secure = true;
+			hosts_save();
+			adv_bonded();
+			conn_secure(ev.bda);
+			ESP_LOGI(TAG, "host %d ready%s", (int)(clcb - hidd_le_env.hidd_clcb),
+				clcb - hidd_le_env.hidd_clcb == host ? ", active" : "");
+			break;
+		case APP_ACKED:
+			conn_ready(ev.conn_id);
+			if (lost && (clcb = ble_host()) && clcb->conn_id == ev.conn_id) {
+				ESP_LOGI(TAG, "first report %d ms after disconnect, reconnected on %s advertising",
+					(int)((esp_timer_get_time() - lost)/1000), adv_name(via));
+				lost = 0;
+			}
+			break;
+		case APP_READ:
+			conn_read(ev.conn_id, describes_reports(ev.read.handle));
+			break;
+		case APP_WRITE:
+			if (ev.write.handle == hidd_le_env.hidd_inst.att_tbl[HIDD_LE_IDX_REPORT_LED_OUT_VAL]
+			    || ev.write.handle == hidd_le_env.hidd_inst.att_tbl[HIDD_LE_IDX_BOOT_KB_OUT_VAL]) {
+				if ((clcb = hidd_clcb_find(ev.conn_id)) && ev.write.len >= 1) {
+					state_leds(clcb - hidd_le_env.hidd_clcb, ev.write.data[0], ev.us);
+				}
+			} else if (ev.write.handle == hidd_le_env.hidd_inst.att_tbl[HIDD_LE_IDX_REPORT_VENDOR_OUT_VAL]) {
+				uint8_t status[2] = { ev.write.len ? ev.write.data[0] : 0 };
+				status[1] = ev.write.len > APP_WRITE_MAX ? CFG_ELEN : cfg_write(ev.write.data, ev.write.len);
+				esp_ble_gatts_set_attr_value(ev.write.handle, sizeof(status), status);
+			} else if (ev.write.handle == hidd_le_env.hidd_inst.att_tbl[HIDD_LE_IDX_REPORT_MOUSE_FEAT_VAL]) {
+				if ((clcb = hidd_clcb_find(ev.conn_id)) && ev.write.len >= 1) {
+					clcb->resolution = ev.write.data[0];
+					ESP_LOGI(TAG, "host %d wheel %s, pan %s", (int)(clcb - hidd_le_env.hidd_clcb),
+						clcb->resolution & HID_RES_WHEEL ? "high resolution" : "detents",
+						clcb->resolution & HID_RES_PAN ? "high resolution" : "detents");
+				}
+			} else if (ev.write.handle == hidd_le_env.hidd_inst.bas_tbl[BAS_IDX_BATT_LVL_NTF_CFG]) {
+				if ((clcb = hidd_clcb_find(ev.conn_id)) && ev.write.len >= 1) {
+					battery_notify(clcb - hidd_le_env.hidd_clcb, ev.write.data[0] & 1);
+				}
+			} else if (ev.write.handle == hidd_le_env.hidd_inst.att_tbl[HIDD_LE_IDX_PROTO_MODE_VAL]) {
+				if ((clcb = hidd_clcb_find(ev.conn_id)) && ev.write.len == 1 && ev.write.data[0] <= HID_PROTOCOL_MODE_REPORT) {
+					clcb->proto_mode = ev.write.data[0];
+					protocol();
+					ESP_LOGI(TAG, "host %d in %s protocol mode", (int)(clcb - hidd_le_env.hidd_clcb),
+						clcb->proto_mode == HID_PROTOCOL_MODE_BOOT ? "boot" : "report");
+				}
+			}
+			break;
+		case APP_CONN_PARAMS:
+			conn_updated(ev.bda, ev.status, ev.params.interval, ev.params.latency, ev.params.timeout);
+			break;
+		case APP_ADV_READY:
+			adv_reconnect(hidd_le_env.hidd_clcb[host].remote_bda);
+			break;
+		case APP_ADV_STOPPED:
+			adv_stopped();
+			break;
+		case APP_BATTERY:
+			ESP_LOGI(TAG, "battery %d%%, %d mV", ev.status, battery.mv);
+			battery_publish(ev.status);
+			break;
+		case APP_CONN:
+			conn_service();
+			break;
+		}
+	}
+}
+
+// the secondary hands its taps to the half with the host
+static void emit_remote(int idx, int ch)
+{
+	Event ev = { .us = esp_timer_get_time(), .ch = ch, .code = idx };
+
+	if (!splitter || !ring_push(&taps, &ev)) {
+		taps_dropped++;
+		return;
+	}
+	xTaskNotifyGive(splitter);
+}
+
+static void emit_local(int idx, int ch)
+{
+	Key key = keymap_key(idx);
+	Event ev = { .us = esp_timer_get_time(), .ch = ch, .code = key.hid, .act = key.act };
+	Event tap[2] = { ev, ev };
+
+	ESP_LOGI(TAG, "sending event: %c %d\n", key.ch, idx);
+	tap[0].flags = EV_PRESS;
+	ring_push_all(&keyring, tap, LENGTH(tap));
+	xTaskNotifyGive(sender);
+}
+
+// the other half's taps go through this half's keymap, as if typed here
+static void deliver(const Tap *t, void *ctx)
+{
+	Key key = keymap_key(t->key);
+	Event ev = { .us = esp_timer_get_time(), .ch = t->ch, .code = key.hid, .act = key.act };
+	Event tap[2] = { ev, ev };
+
+	if (!sender) {
+		return;
+	}
+	tap[0].flags = EV_PRESS;
+	ring_push_all(&remote, tap, LENGTH(tap));
+	xTaskNotifyGive(sender);
+}
+
+static void received(const uint8_t *frame, int len)
+{
+	Datagram d = { .len = len };
+
+	memcpy(d.frame, frame, len);
+	// frames can land before the link task is up, it drains them on start
+	if (xQueueSend(datagrams, &d, 0) == pdTRUE && splitter) {
+		xTaskNotifyGive(splitter);
+	}
+}
+
+// on the app task, as cfg applies a role record
+static bool forward_role(uint8_t side, uint8_t primary)
+{
+	if (!splitter) {
+		return false;
+	}
+	atomic_store(&offer, side | primary << 8);
+	xTaskNotifyGive(splitter);
+	return true;
+}
+
+static bool offered_role(uint8_t side, uint8_t primary, void *ctx)
+{
+	return role_offered(side, primary);
+}
+
+static void answered_role(bool taken, void *ctx)
+{
+	role_answered(taken);
+}
+
+/*
+ * Owns the split protocol: datagrams from the Wi-Fi task and taps from
+ * sensing both come through here, so its state needs no locking.
+ */
+static void link_split(void *pvParameters)
+{
+	Datagram d;
+	Event ev;
+	Tap t;
+	uint32_t wait = 0;
+	int o;
+
+	for (;;) {
+		if ((o = atomic_exchange(&offer, -1)) >= 0) {
+			split_offer(&split, o & 0xff, o >> 8, esp_timer_get_time());
+		}
+		while (xQueueReceive(datagrams, &d, 0) == pdTRUE) {
+			split_input(&split, d.frame, d.len, esp_timer_get_time());
+		}
+		while (ring_pop(&taps, &ev)) {
+			t.key = ev.code;
+			t.ch = ev.ch;
+			if (!split_tap(&split, &t, esp_timer_get_time())) {
+				taps_dropped++;
+			}
+		}
+		wait = split_poll(&split, esp_timer_get_time());
+		ulTaskNotifyTake(pdTRUE, wait ? MAX(1, pdMS_TO_TICKS(wait/1000)) : portMAX_DELAY);
+	}
+}
+
+// settled finger positions wait on the gestures
+static void finger(int idx, int ch)
+{
+	gesture_tap(&gestures, idx, ch, esp_timer_get_time());
 }
 
 void listen_adc(void *pvParameters) {
-	int i, j;
+	int i;
 	int n;
 	uint8_t buf[LENGTH(channels)*SOC_ADC_DIGI_RESULT_BYTES*32];
-	uint16_t min[8], max[8];
-	const Key *key;
 	adc_digi_output_data_t *bp;
 	esp_err_t ret;
+	uint16_t items[8] = { 0 };
 
-	uint16_t items[8], prev[8][8], sent[8];
-	for (i = 0; i < 8; i++) {
-		for (j = 0; j < LENGTH(prev); j++) {
-			prev[j][i] = ~0;
-		}
-		items[i] = 0;
-		max[i] = 0;
-		min[i] = ~0;
-		sent[i] = ~0;
-	}
+	_Static_assert(LENGTH(channels) == DETECT_CHANNELS, "one detector channel per adc channel");
 
 	adc_continuous_handle_cfg_t adc_config = {
 		.max_store_buf_size = sizeof(buf)*4,
 		.conv_frame_size = sizeof(buf)*1,
 	};
 
-	adc_digi_pattern_config_t adc_pattern[LENGTH(channels)];
-	for (i = 0; i < LENGTH(channels); i++) {
+	// the finger channels BATTERY_DUTY times over, then the battery once
+	adc_digi_pattern_config_t adc_pattern[LENGTH(channels)*BATTERY_DUTY + 1];
+	_Static_assert(LENGTH(adc_pattern) <= SOC_ADC_PATT_LEN_MAX, "adc pattern too long");
+	for (i = 0; i < LENGTH(adc_pattern); i++) {
 		adc_pattern[i].atten = ADC_ATTEN_DB_12;
-		adc_pattern[i].channel = channels[i] & 0x7;
+		adc_pattern[i].channel = (i < LENGTH(adc_pattern)-1 ? channels[i % LENGTH(channels)] : BATTERY_CHANNEL) & 0x7;
 		adc_pattern[i].unit = ADC_UNIT_1;
 		adc_pattern[i].bit_width = SOC_ADC_DIGI_MAX_BITWIDTH;
 	}
@@ -350,7 +868,7 @@ void listen_adc(void *pvParameters) {
 		.sample_freq_hz = 20 * 1000,
 		.conv_mode = ADC_CONV_SINGLE_UNIT_1,
 		.format = ADC_DIGI_OUTPUT_FORMAT_TYPE2,
-		.pattern_num = LENGTH(channels),
+		.pattern_num = LENGTH(adc_pattern),
 		.adc_pattern = adc_pattern,
 	};
 
@@ -364,8 +882,34 @@ void listen_adc(void *pvParameters) {
 		return;
 	}
 
-	uint64_t conv[LENGTH(channels)];
-	for (j = 0;; j++) {
+	// the eFuse curve for the battery's attenuation, a straight line is off by 100 mV
+	adc_cali_curve_fitting_config_t cali_cfg = {
+		.unit_id = ADC_UNIT_1,
+		.chan = BATTERY_CHANNEL,
+		.atten = ADC_ATTEN_DB_12,
+		.bitwidth = SOC_ADC_DIGI_MAX_BITWIDTH,
+	};
+	adc_cali_handle_t cali = NULL;
+	int mv;
+
+	if ((ret = adc_cali_create_scheme_curve_fitting(&cali_cfg, &cali)) != ESP_OK) {
+		ESP_LOGW(TAG, "no adc calibration, battery not reported: %s", esp_err_to_name(ret));
+		cali = NULL;
+	}
+
+	uint64_t conv[8];
+	int64_t start, last = 0;
+	uint32_t dt, cycles;
+	int8_t d[2];
+	int g;
+	Pointer stick;
+	Matcher matchers[GESTURE_TEMPLATES];
+	Detect detect;
+
+	pointer_init(&stick);
+	gesture_init(&gestures, gesture_templates, matchers, GESTURE_TEMPLATES, emit);
+	detect_init(&detect, role->base, H);
+	for (;;) {
 		if (adc_continuous_start(adc) != ESP_OK) {
 			ESP_LOGI(TAG, "failed to start ADC");
 			return;
@@ -378,10 +922,20 @@ void listen_adc(void *pvParameters) {
 
 		adc_continuous_stop(adc);
 
+		start = esp_timer_get_time();
+		dt = last ? start - last : 0;
+		if (last) {
+			hist_add(&period, start - last);
+		}
+		last = start;
+
 		memset(conv, 0, sizeof(conv));
 		memset(items, 0, sizeof(items));
 		for (i = 0; i < n; i += SOC_ADC_DIGI_RESULT_BYTES) {
 			bp = (void*) &buf[i];
+			if (bp->type2.channel >= LENGTH(conv)) {
+				continue;
+			}
 			conv[bp->type2.channel] += bp->type2.data;
 			items[bp->type2.channel]++;
 		}
@@ -390,73 +944,71 @@ void listen_adc(void *pvParameters) {
 			items[i] = conv[i]/items[i];
 		}
 
-		xQueueSend(DisplayQueue, &items[0], ~0);
-
-		for (i = 0; i < 6; i++) {
-			if (items[i] < min[i]) {
-				min[i] = items[i];
-			}
-			if (items[i] > max[i]) {
-				max[i] = items[i];
-			}
-			if (min[i] >= max[i]) {
-				continue;
-			}
+		bus_publish(&telemetry, items, LENGTH(channels), esp_timer_get_time());
 
-			n = items[i]-min[i];
-			switch (i) {
-			case 0: case 1: case 2: case 3:
-				items[i] = MIN(6-1, (sqrt(n)*sqrt(max[i]-min[i])*(6))/(max[i]-min[i]));
-				break;
-			case 4: case 5:
-				items[i] = MIN((H)-1, (n*(H))/(max[i]-min[i]));
-				break;
-			}
+		if (cali && items[BATTERY_CHANNEL]
+		    && adc_cali_raw_to_voltage(cali, conv[BATTERY_CHANNEL]/items[BATTERY_CHANNEL], &mv) == ESP_OK
+		    && battery_add(&battery, mv)) {
+			AppEvent bev = { .type = APP_BATTERY, .status = battery.level };
+			post(&bev);
 		}
 
-		for (i = 0; i < 4; i++) {
-			n = items[i];
-			/*
-			ESP_LOGI(TAG, "maybe sending event: %d\n", n);
+		if (primary && pointer_step(&stick, &items[4], dt, d)) {
+			atomic_fetch_add(&motion[0], d[0]);
+			atomic_fetch_add(&motion[1], d[1]);
+			xTaskNotifyGive(sender);
+		}
 
-			*/
-			if (n < 2) {
-				sent[i] = ~0;
-				continue;
-			}
-			n = MIN(n-2, 4);
-			int match = 1, k = 0;
-			for (k = 0; k < LENGTH(prev); k++) {
-				if (prev[k][i] != n) {
-					match = 0;
-				}
-			}
-			prev[j%LENGTH(prev)][i] = n;
-			if (!match)  {
-				continue;
-			}
-			if (sent[i] == n) {
-				sent[i] = ~0;
-				continue;
-			}
-			memset(prev, ~0, sizeof(prev));
-			key = &qwerty[(i*4)+n+(left?24:0)];
-			ESP_LOGI(TAG, "sending event: %c %d\n", key->ch, n);
+		detect_levels(&detect, items);
 
-			xQueueSend(KeyboardQueue, &key, ~0);
+		cycles = esp_cpu_get_cycle_count();
+		g = gesture_step(&gestures, items, start);
+		hist_add(&gesture_time, esp_cpu_get_cycle_count() - cycles);
+		if (g >= 0) {
+			ESP_LOGI(TAG, "gesture %d", g);
+			emit(KEYMAP_GESTURE + g, GESTURE_FINGERS + g);	// past the finger channels
 		}
+
+		detect_fingers(&detect, items, finger);
+
+		hist_add(&loop, esp_timer_get_time() - start);
 	}
 	adc_continuous_stop(adc);
 	adc_continuous_deinit(adc);
 
 }
 
+// a "T us raw..." line per frame, dropped frames are counted by the bus
+static void record(void *pvParameters)
+{
+	Sub sub;
+	Frame f;
+
+	bus_subscribe(&telemetry, &sub, "trace");
+	for (;;) {
+		if (!bus_read(&sub, &f)) {
+			vTaskDelay(1);
+			continue;
+		}
+		printf("T %lu %u %u %u %u %u %u\n", (unsigned long)f.us,
+			f.raw[0], f.raw[1], f.raw[2], f.raw[3], f.raw[4], f.raw[5]);
+	}
+}
+
 void draw(void *pvParameters)
 {
 	int i, j;
 	uint8_t buf[4][128];
-	uint32_t n, m;
+	uint32_t n, m, worst, frames = 0;
 	uint16_t items[8], min[8], max[8];
+	Frame frame;
+	Sub sub;
+	Pacer pacer;
+	HostState shown = { 0 }, st;
+	int slot, was = -1;
+
+	pacer_init(&pacer, "draw");
+	bus_subscribe(&telemetry, &sub, "display");
 	for (i = 0; i < 8; i++) {
 		items[i] = 0;
 		max[i] = 0;
@@ -466,8 +1018,42 @@ void draw(void *pvParameters)
 	esp_lcd_panel_set_gap(panel, 0, 0);
 	memset(buf, 0, sizeof(buf));
 	esp_lcd_panel_draw_bitmap(panel, 0, 0, W, H, &buf);
-	for (;;) {
-		xQueueReceive(DisplayQueue, items, ~0);
+	for (;; pacer_period(&pacer, DRAW_PERIOD_US)) {
+		if (!bus_read(&sub, &frame)) {
+			continue;
+		}
+		memcpy(items, frame.raw, sizeof(items));
+		if (++frames % 512 == 0) {
+			for (i = 0; i < telemetry.nsubs; i++) {
+				ESP_LOGI(TAG, "bus %s: %d frames dropped", telemetry.subs[i]->name, (int)telemetry.subs[i]->dropped);
+			}
+			hist_log(&period);
+			hist_log(&loop);
+			hist_log(&gesture_time);
+			hist_log(report_latency());
+			hist_log(&gatts_time);
+			hist_log(&gap_time);
+			hist_log(&led_time);
+			if (events_dropped || events_unexpected) {
+				ESP_LOGW(TAG, "app events: %d dropped, %d unexpected", (int)events_dropped, (int)events_unexpected);
+			}
+			ESP_LOGI(TAG, "%d reports coalesced", (int)report_merged());
+			conn_log();
+			if (split.frames || split.rtt_n) {
+				ESP_LOGI(TAG, "split: %d frames, %d resent, %d given up, %d dups, %d skipped, %d taps dropped, rtt %d us avg %d max",
+					(int)split.frames, (int)split.resent, (int)split.gaveup, (int)split.dups, (int)split.skipped,
+					(int)taps_dropped, (int)(split.rtt_n ? split.rtt_sum/split.rtt_n : 0), (int)split.rtt_max);
+			}
+			if (report_lost()) {
+				ESP_LOGW(TAG, "%d reports never completed", (int)report_lost());
+			}
+			if ((worst = hist_take_max(&loop)) > LOOP_BUDGET_US) {
+				ESP_LOGW(TAG, "detection loop took %d us, budget %d us", (int)worst, LOOP_BUDGET_US);
+			}
+			if ((worst = hist_take_max(&gesture_time)) > GESTURE_BUDGET_CYCLES) {
+				ESP_LOGW(TAG, "gestures took %d cycles, budget %d", (int)worst, GESTURE_BUDGET_CYCLES);
+			}
+		}
 
 		m = 0;
 		for (i = 0; i < 6; i++) {
@@ -506,9 +1092,24 @@ void draw(void *pvParameters)
 
 		buf[m/8][n] = 1<<(m%8);
 
+		// num, caps, scroll, compose and kana along the top right
+		slot = out == &usb_output ? USB_SLOT : host;
+		st = state_host(slot);
+		for (i = 0; i < 5; i++) {
+			for (j = 0; j < 5; j++) {
+				buf[0][(W/4)*3 + 2 + i*6 + j] = st.leds & 1<<i || j == 0 || j == 4 ? 0x3e : 0x22;
+			}
+		}
+
 		if (esp_lcd_panel_draw_bitmap(panel, 0, 0, W, H, buf)) {
 			break;
 		}
+		// a host switch shows old state, only count writes that arrived since
+		if (slot == was && st.written && (st.us != shown.us || st.leds != shown.leds)) {
+			hist_add(&led_time, state_age(st, esp_timer_get_time()));
+		}
+		shown = st;
+		was = slot;
 		for (i = 3; i >= 0; i--) {
 			for (j = W/4; j < (W/4)*3; j++) {
 				buf[i][j] <<= 1;
@@ -517,66 +1118,442 @@ void draw(void *pvParameters)
 				}
 			}
 		}
-		vTaskDelay(pdMS_TO_TICKS(20));
 	}
 
 	esp_lcd_panel_disp_on_off(panel, false);
 }
 
-void bluetooth_send(void *pvParameters)
+static bool ble_ready(void)
 {
-	Key *key;
-	esp_err_t ret;
+	return ble_host() != NULL;
+}
 
-	for (;; vTaskDelay(pdMS_TO_TICKS(10))) {
-		xQueueReceive(KeyboardQueue, &key, ~0);
-		if (!sec_conn) {
-			continue;
+static int ble_send(const Report *r)
+{
+	hidd_clcb_t *clcb;
+	int ret;
+
+	if ((clcb = ble_host()) == NULL) {
+		return ESP_ERR_INVALID_STATE;
+	}
+	ret = hid_dev_send_report(hidd_le_env.gatt_if, clcb->conn_id, r->id, HID_REPORT_TYPE_INPUT, r->len, (uint8_t *)r->data);
+	// boot protocol hosts only take the keyboard
+	return ret == HID_RPT_NOT_FOUND ? REPORT_DROP : ret;
+}
+
+static uint8_t ble_resolution(void)
+{
+	hidd_clcb_t *clcb = ble_host();
+
+	return clcb ? clcb->resolution : 0;
+}
+
+// one mouse report per connection event
+static uint32_t ble_interval(void)
+{
+	hidd_clcb_t *clcb = ble_host();
+	const Link *l = clcb ? conn_get(clcb->conn_id) : NULL;
+
+	return l && l->interval ? l->interval*1250 : MOUSE_INTERVAL_US;
+}
+
+static void ble_activity(void)
+{
+	hidd_clcb_t *clcb = ble_host();
+
+	if (clcb) {
+		conn_activity(clcb->conn_id);
+	}
+}
+
+static const Output ble_output = { "bluetooth", ble_ready, ble_send, ble_resolution, ble_interval, ble_activity };
+
+static int transmit(const Report *r)
+{
+	return out->send(r);
+}
+
+/*
+ * A failed notify leaves the report queued, so back off and try again.
+ * Past SEND_RETRIES the queue is kept, releases and all, and each later
+ * pump tries once; the sender's poll while reports are pending paces it.
+ */
+static void pump(void)
+{
+	static bool failing;
+	int i, ret;
+
+	for (i = 0; out->ready() && (ret = report_pump(esp_timer_get_time())); i++) {
+		if (failing || i >= SEND_RETRIES) {
+			if (!failing) {
+				ESP_LOGE(TAG, "notify failing (%d), holding %d reports", ret, report_pending());
+			}
+			failing = true;
+			return;
 		}
+		pacer_sleep(&radio, SEND_RETRY_US);
+	}
+	failing = false;
+}
+
+static bool moving(void)
+{
+	return atomic_load(&motion[0]) || atomic_load(&motion[1]);
+}
+
+/*
+ * Detents in 1/256, the fraction carries over so slow scrolling still
+ * moves.  Hosts that enabled the resolution multiplier get HID_RES_MULT
+ * steps per detent.
+ */
+static int32_t scroll(int32_t *acc, int32_t counts, bool hires)
+{
+	int32_t out;
 
-		if ((ret = esp_hidd_send_keyboard_value(hid_conn_id, 0, &key->hid, 1))) {
-			sec_conn = false;
-			ESP_LOGI(TAG, "failed sending key %c - %d", key->ch, ret);
+	*acc += counts * 256 * (hires ? HID_RES_MULT : 1) / SCROLL_COUNTS;
+	out = CLAMP(*acc >> 8, -127, 127);
+	*acc -= out << 8;
+	return out;
+}
+
+/*
+ * Stick motion goes out at most once per transport interval.  Faster
+ * frames pile up in motion, and a report still queued behind the window
+ * takes later motion into itself, so the pointer never runs ahead of keys.
+ */
+static void move(void)
+{
+	static int64_t next;
+	static int32_t wheel, pan;
+	int64_t now = esp_timer_get_time();
+	Report r = { .us = now, .id = HID_RPT_ID_MOUSE_IN, .len = HID_RPT_LEN_MOUSE_IN };
+	int32_t x, y;
+
+	if (!moving() || now < next) {
+		return;
+	}
+	if (!out->ready()) {
+		atomic_store(&motion[0], 0);
+		atomic_store(&motion[1], 0);
+		return;
+	}
+	x = atomic_exchange(&motion[0], 0);
+	y = atomic_exchange(&motion[1], 0);
+	if (scrolling) {
+		// pushing the stick up scrolls up, which is a positive wheel
+		r.data[3] = scroll(&wheel, -y, out->resolution() & HID_RES_WHEEL);
+		r.data[4] = scroll(&pan, x, out->resolution() & HID_RES_PAN);
+		x = y = 0;
+		if (!r.data[3] && !r.data[4]) {
+			return;
+		}
+	} else {
+		wheel = pan = 0;
+		r.data[1] = CLAMP(x, -127, 127);
+		r.data[2] = CLAMP(y, -127, 127);
+	}
+	if (!report_queue(&r)) {
+		atomic_fetch_add(&motion[0], x);
+		atomic_fetch_add(&motion[1], y);
+		wheel += (int8_t)r.data[3] * 256;
+		pan += (int8_t)r.data[4] * 256;
+		return;
+	}
+	// the rest of a long throw goes in the next report
+	atomic_fetch_add(&motion[0], x - (int8_t)r.data[1]);
+	atomic_fetch_add(&motion[1], y - (int8_t)r.data[2]);
+	next = now + out->interval();
+	out->activity();
+}
+
+// waits for room behind whatever is queued, so reports keep their order
+static int queue_report(const Report *r)
+{
+	while (!report_queue(r)) {
+		pump();
+		ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(20));
+		if (!out->ready()) {
+			return -1;
+		}
+	}
+	pump();
+	return 0;
+}
+
+static int send_keys(uint8_t mods, uint8_t *held, uint8_t n)
+{
+	return keys_send(&keys, esp_timer_get_time(), mods, held, n);
+}
+
+static void wait_ms(int ms)
+{
+	pacer_sleep(&radio, ms*1000);
+	pump();
+}
+
+/*
+ * Release everything on the current host before moving away, otherwise
+ * it is left with stuck keys.  Bounded so a host that stopped acking
+ * can't hold the switch up.
+ */
+static void release(void)
+{
+	int i;
+
+	if (out->ready()) {
+		keys_release(&keys, esp_timer_get_time());
+		for (i = 0; report_pending() && out->ready() && i < SWITCH_DRAIN; i++) {
+			pump();
+			ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(10));
+		}
+	}
+	report_reset();
+	keys_forget(&keys);
+}
+
+static void switch_host(int slot)
+{
+	hidd_clcb_t *clcb;
+
+	if (slot < 0 || slot >= HID_MAX_APPS || slot == host) {
+		return;
+	}
+	if (out != &ble_output) {
+		host = slot;
+		protocol();
+		ESP_LOGI(TAG, "host %d takes over once usb is gone", slot);
+		return;
+	}
+	release();
+	host = slot;
+	protocol();
+	if ((clcb = ble_host())) {
+		report_congest(clcb->congest);
+		conn_activity(clcb->conn_id);
+	} else {
+		report_congest(false);
+	}
+	ESP_LOGI(TAG, "switched to host %d%s", slot, clcb ? "" : " (not connected)");
+}
+
+// USB while a host has it enumerated, Bluetooth otherwise
+static void route(void)
+{
+	const Output *o = usb_output.ready() ? &usb_output : &ble_output;
+	hidd_clcb_t *clcb;
+
+	if (o == out) {
+		return;
+	}
+	release();
+	out = o;
+	clcb = ble_host();
+	report_congest(out == &ble_output && clcb && clcb->congest);
+	ESP_LOGI(TAG, "reports go over %s", out->name);
+}
+
+static void usb_woken(void)
+{
+	xTaskNotifyGive(sender);
+}
+
+void send_reports(void *pvParameters)
+{
+	Event ev;
+	uint32_t dropped = 0;
+
+	pacer_init(&radio, "radio");
+	if (PACER_BENCH) {
+		hrt_compare(&radio);
+	}
+	report_init(transmit);
+	report_coalesce(HID_RPT_ID_KEY_IN, report_merge_keys);
+	report_coalesce(HID_RPT_ID_MOUSE_IN, report_merge_mouse);
+	report_coalesce(HID_RPT_ID_CC_IN, report_merge_same);
+	keys_init(&keys, queue_report, hid_consumer_build_report, HID_RPT_LEN_CC_IN);
+
+	for (;;) {
+		route();
+		if (!ring_pop(&keyring, &ev) && !ring_pop(&remote, &ev)) {
+			move();
+			pump();
+			// wake on new input or a completion; poll while reports are in flight
+			ulTaskNotifyTake(pdTRUE, moving() ? 1 : report_pending() ? pdMS_TO_TICKS(20) : portMAX_DELAY);
+			continue;
+		}
+		if (ring_dropped(&keyring) != dropped) {
+			dropped = ring_dropped(&keyring);
+			ESP_LOGI(TAG, "key ring overflow, %d events dropped", (int)dropped);
+		}
+		if (ev.act == ACT_HOST) {
+			if (ev.flags & EV_PRESS) {
+				switch_host(ev.code);
+			}
+			continue;
+		}
+		if (ev.act == ACT_SCROLL) {
+			if (ev.flags & EV_PRESS) {
+				scrolling = !scrolling;
+				ESP_LOGI(TAG, "stick %s", scrolling ? "scrolls" : "points");
+			}
+			continue;
+		}
+		if (!out->ready()) {
+			report_reset();
+			keys_forget(&keys);
 			continue;
 		}
+		out->activity();
 
-		if (esp_hidd_send_keyboard_value(hid_conn_id, 0, &key->hid, 0)) {
-			sec_conn = false;
-			ESP_LOGI(TAG, "failed down");
+		if (ev.act == ACT_MACRO) {
+			if ((ev.flags & EV_PRESS) && macro_play(ev.code, send_keys, wait_ms) < 0) {
+				ESP_LOGI(TAG, "failed playing macro %d", ev.code);
+			}
 			continue;
 		}
+		keys_event(&keys, &ev);
 	}
 }
 
-void app_main(void)
+static esp_err_t ble_start(void)
 {
 	esp_err_t ret;
 	uint8_t key_size, init_key, rsp_key;
 
-	DisplayQueue = xQueueCreate(1, sizeof(uint16_t)*6);
-	if (DisplayQueue == NULL) {
-		ESP_LOGI(TAG, "failed create input queue");
-		return;
+	ESP_ERROR_CHECK(esp_bt_controller_mem_release(ESP_BT_MODE_CLASSIC_BT));
+
+	ESP_LOGI(TAG, "initalizing bluetooth");
+	esp_bt_controller_config_t bt = BT_CONTROLLER_INIT_CONFIG_DEFAULT();
+	if ((ret = esp_bt_controller_init(&bt))) {
+		ESP_LOGE(TAG, "%s initialize controller failed",
+			 __func__);
+		return ret;
 	}
 
-	KeyboardQueue = xQueueCreate(1, sizeof(Key*));
-	if (KeyboardQueue == NULL) {
-		ESP_LOGI(TAG, "failed create input queue");
-		return;
+	if ((ret = esp_bt_controller_enable(ESP_BT_MODE_BLE))) {
+		ESP_LOGE(TAG, "enable controller failed");
+		return ret;
 	}
 
-	MouseQueue = xQueueCreate(64, sizeof(uint16_t)*6);
-	if (MouseQueue == NULL) {
-		ESP_LOGI(TAG, "failed create input queue");
-		return;
+	if ((ret = esp_bluedroid_init())) {
+		ESP_LOGE(TAG, "init bluedroid failed");
+		return ret;
 	}
 
-	NetworkQueue = xQueueCreate(64, sizeof(uint16_t)*6);
-	if (NetworkQueue == NULL) {
-		ESP_LOGI(TAG, "failed create input queue");
-		return;
+	if ((ret = esp_bluedroid_enable())) {
+		ESP_LOGE(TAG, "init bluedroid failed");
+		return ret;
+	}
+
+	if ((ret = esp_hidd_profile_init()) != ESP_OK) {
+		ESP_LOGE(TAG, "init bluedroid failed");
+		return ret;
+	}
+
+	hosts_load();
+
+	events = xQueueCreate(APP_QUEUE, sizeof(AppEvent));
+	xTaskCreatePinnedToCore(&app_events, "app_events", 2048<<1, NULL, PRIO_APP, NULL, CORE_RADIO);
+
+	if ((ret = adv_init(&advert_config)) != ESP_OK) {
+		ESP_LOGE(TAG, "init advertising failed");
+		return ret;
+	}
+	adv_bonded();
+
+	esp_ble_gap_register_callback(gap_event_handler);
+
+	if ((ret = esp_ble_gatts_register_callback(gatts_event_handler)) != ESP_OK) {
+		ESP_LOGE(TAG, "init bluedroid failed");
+		return ret;
+	}
+
+	if ((ret = esp_ble_gatts_app_register(BATTRAY_APP_ID)) != ESP_OK) {
+		ESP_LOGE(TAG, "init battray app failed");
+		return ret;
+	}
+
+	if ((ret = esp_ble_gatts_app_register(HIDD_APP_ID)) != ESP_OK) {
+		ESP_LOGE(TAG, "init hidd app failed");
+		return ret;
+	}
+
+	if ((ret = conn_init(kick_conn)) != ESP_OK) {
+		ESP_LOGE(TAG, "init connection manager failed");
+		return ret;
 	}
 
+	esp_ble_auth_req_t auth_req = ESP_LE_AUTH_BOND;
+	esp_ble_io_cap_t   iocap    = ESP_IO_CAP_NONE;
+	init_key                    = ESP_BLE_ENC_KEY_MASK | ESP_BLE_ID_KEY_MASK;
+	rsp_key                     = ESP_BLE_ENC_KEY_MASK | ESP_BLE_ID_KEY_MASK;
+	key_size                    = 16;
+	esp_ble_gap_set_security_param(ESP_BLE_SM_AUTHEN_REQ_MODE, &auth_req, sizeof(auth_req));
+	esp_ble_gap_set_security_param(ESP_BLE_SM_IOCAP_MODE,      &iocap,    sizeof(iocap));
+	esp_ble_gap_set_security_param(ESP_BLE_SM_MAX_KEY_SIZE,    &key_size, sizeof(key_size));
+	esp_ble_gap_set_security_param(ESP_BLE_SM_SET_INIT_KEY,    &init_key, sizeof(init_key));
+	esp_ble_gap_set_security_param(ESP_BLE_SM_SET_RSP_KEY,     &rsp_key,  sizeof(rsp_key));
+	return ESP_OK;
+}
+
+/*
+ * Holding the boot button through reset enters the ROM downloader, so
+ * the gestures are holds begun within BUTTON_WINDOW_MS of the firmware
+ * starting: let go after BUTTON_PAIR_MS to pair the halves, or keep it
+ * down for BUTTON_RESET_MS to forget this half's role and restart.
+ */
+static void watch_button(void *pvParameters)
+{
+	TickType_t start = xTaskGetTickCount(), down = 0, now;
+	bool pressed = false, pair = false;
+	esp_err_t ret;
+
+	gpio_reset_pin(BOOT_BUTTON);
+	gpio_set_direction(BOOT_BUTTON, GPIO_MODE_INPUT);
+	gpio_set_pull_mode(BOOT_BUTTON, GPIO_PULLUP_ONLY);
+	ESP_LOGI(TAG, "within %d s, hold the boot button %d s to pair the halves, %d s to forget the role",
+	         BUTTON_WINDOW_MS / 1000, BUTTON_PAIR_MS / 1000, BUTTON_RESET_MS / 1000);
+	for (;;) {
+		vTaskDelay(pdMS_TO_TICKS(BUTTON_POLL_MS));
+		now = xTaskGetTickCount();
+		if (!gpio_get_level(BOOT_BUTTON)) {
+			if (!pressed && now - start < pdMS_TO_TICKS(BUTTON_WINDOW_MS)) {
+				pressed = true;
+				down = now;
+			}
+			if (pressed && now - down >= pdMS_TO_TICKS(BUTTON_RESET_MS)) {
+				if ((ret = role_forget()) != ESP_OK) {
+					ESP_LOGE(TAG, "role not forgotten: %s", esp_err_to_name(ret));
+				}
+				// restart once let go, to stay clear of the downloader
+				while (!gpio_get_level(BOOT_BUTTON)) {
+					vTaskDelay(pdMS_TO_TICKS(BUTTON_POLL_MS));
+				}
+				esp_restart();
+			}
+			continue;
+		}
+		if ((pair = pressed && now - down >= pdMS_TO_TICKS(BUTTON_PAIR_MS)) ||
+		    now - start >= pdMS_TO_TICKS(BUTTON_WINDOW_MS)) {
+			break;
+		}
+		pressed = false;
+	}
+	gpio_reset_pin(BOOT_BUTTON);
+	// app_main notifies this task, so it may not end first
+	ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+	if (pair && (ret = espnow_pair()) != ESP_OK) {
+		ESP_LOGW(TAG, "pairing failed: %s", esp_err_to_name(ret));
+	}
+	vTaskDelete(NULL);
+}
+
+void app_main(void)
+{
+	esp_err_t ret;
+
+	xTaskCreatePinnedToCore(&watch_button, "watch_button", 2048<<1, NULL, PRIO_DISPLAY, &button, CORE_RADIO);
+
 	ESP_LOGI(TAG, "Initialize I2C bus");
 	i2c_master_bus_handle_t i2c_bus = NULL;
 	i2c_master_bus_config_t bus_config = {
@@ -637,66 +1614,47 @@ void app_main(void)
 
 	ESP_ERROR_CHECK(ret);
 
-	ESP_ERROR_CHECK(esp_bt_controller_mem_release(ESP_BT_MODE_CLASSIC_BT));
-
-
-	ESP_LOGI(TAG, "initalizing bluetooth");
-	esp_bt_controller_config_t bt = BT_CONTROLLER_INIT_CONFIG_DEFAULT();
-	if ((ret = esp_bt_controller_init(&bt))) {
-		ESP_LOGE(TAG, "%s initialize controller failed",
-			 __func__);
-		return;
+	if ((ret = keymap_load()) != ESP_OK) {
+		ESP_LOGI(TAG, "using default keymap: %s", esp_err_to_name(ret));
 	}
 
-	if ((ret = esp_bt_controller_enable(ESP_BT_MODE_BLE))) {
-		ESP_LOGE(TAG, "enable controller failed");
-		return;
+	if ((ret = macro_load()) != ESP_OK) {
+		ESP_LOGI(TAG, "no stored macros: %s", esp_err_to_name(ret));
 	}
 
-	if ((ret = esp_bluedroid_init())) {
-		ESP_LOGE(TAG, "init bluedroid failed");
-		return;
-	}
+	role = role_detect(forward_role);
+	primary = role->primary;
+	emit = primary ? emit_local : emit_remote;
 
-	if ((ret = esp_bluedroid_enable())) {
-		ESP_LOGE(TAG, "init bluedroid failed");
-		return;
-	}
+	hist_init(&gatts_time, "gatts callback", 10);
+	hist_init(&gap_time, "gap callback", 10);
+	hist_init(&led_time, "led write to display", 1000);
+	hist_init(&period, "frame period", 500);
+	hist_init(&loop, "detection loop", 50);
+	hist_init(&gesture_time, "gesture cycles", GESTURE_BUDGET_CYCLES/16);
 
-	if ((ret = esp_hidd_profile_init()) != ESP_OK) {
-		ESP_LOGE(TAG, "init bluedroid failed");
-		return;
+	if (primary) {
+		if (ble_start() != ESP_OK) {
+			return;
+		}
+		xTaskCreatePinnedToCore(&send_reports, "send_reports", 2048<<1, NULL, PRIO_RADIO, &sender, CORE_RADIO);
+		if ((ret = usb_init(usb_woken)) != ESP_OK) {
+			ESP_LOGE(TAG, "init usb failed: %s", esp_err_to_name(ret));
+		}
 	}
 
-	esp_ble_gap_register_callback(gap_event_handler);
-
-	if ((ret = esp_ble_gatts_register_callback(gatts_event_handler)) != ESP_OK) {
-		ESP_LOGE(TAG, "init bluedroid failed");
-		return;
+	datagrams = xQueueCreate(8, sizeof(Datagram));
+	split_init(&split, &espnow, esp_random(), deliver, offered_role, answered_role, NULL);
+	if ((ret = espnow_init(&espnow, received)) != ESP_OK) {
+		ESP_LOGE(TAG, "init split link failed: %s", esp_err_to_name(ret));
+	} else {
+		xTaskCreatePinnedToCore(&link_split, "link_split", 2048<<1, NULL, PRIO_RADIO, &splitter, CORE_RADIO);
 	}
+	xTaskNotifyGive(button);
 
-	if ((ret = esp_ble_gatts_app_register(BATTRAY_APP_ID)) != ESP_OK) {
-		ESP_LOGE(TAG, "init battray app failed");
-		return;
+	xTaskCreatePinnedToCore(&listen_adc, "listen_adc", 2048<<1, NULL, PRIO_SENSE, NULL, CORE_SENSE);
+	if (TRACE) {
+		xTaskCreatePinnedToCore(&record, "record", 2048<<1, NULL, PRIO_DISPLAY, NULL, CORE_RADIO);
 	}
-
-	if ((ret = esp_ble_gatts_app_register(HIDD_APP_ID)) != ESP_OK) {
-		ESP_LOGE(TAG, "init hidd app failed");
-		return;
-	}
-
-	esp_ble_auth_req_t auth_req = ESP_LE_AUTH_BOND;
-	esp_ble_io_cap_t   iocap    = ESP_IO_CAP_NONE;
-	init_key                    = ESP_BLE_ENC_KEY_MASK | ESP_BLE_ID_KEY_MASK;
-	rsp_key                     = ESP_BLE_ENC_KEY_MASK | ESP_BLE_ID_KEY_MASK;
-	key_size                    = 16;
-	esp_ble_gap_set_security_param(ESP_BLE_SM_AUTHEN_REQ_MODE, &auth_req, sizeof(auth_req));
-	esp_ble_gap_set_security_param(ESP_BLE_SM_IOCAP_MODE,      &iocap,    sizeof(iocap));
-	esp_ble_gap_set_security_param(ESP_BLE_SM_MAX_KEY_SIZE,    &key_size, sizeof(key_size));
-	esp_ble_gap_set_security_param(ESP_BLE_SM_SET_INIT_KEY,    &init_key, sizeof(init_key));
-	esp_ble_gap_set_security_param(ESP_BLE_SM_SET_RSP_KEY,     &rsp_key,  sizeof(rsp_key));
-
-	xTaskCreate(&listen_adc, "listen_adc", 2048<<1, NULL, 5, NULL);
-	xTaskCreate(&draw, "draw", 2048<<1, NULL, 5, NULL);
-	xTaskCreate(&bluetooth_send, "bluetooth_send", 2048<<1, NULL, 5, NULL);
+	xTaskCreatePinnedToCore(&draw, "draw", 2048<<1, NULL, PRIO_DISPLAY, NULL, CORE_RADIO);
 }
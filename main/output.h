@@ -0,0 +1,18 @@
+#include <stdint.h>
+#include <stdbool.h>
+
+struct Report;
+
+/*
+ * Where the report queue drains to.  Key handling, merging and pacing are
+ * the same whichever is active; a transport only says whether a host is
+ * listening and takes reports off the queue.
+ */
+typedef struct Output {
+	const char *name;
+	bool (*ready)(void);	// a host takes reports
+	int (*send)(const struct Report *r);	// 0, REPORT_DROP, or an error that leaves r queued
+	uint8_t (*resolution)(void);	// HID_RES_* bits the host enabled
+	uint32_t (*interval)(void);	// us between mouse reports
+	void (*activity)(void);	// input is on its way, wake the link
+} Output;
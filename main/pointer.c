@@ -0,0 +1,68 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include "pointer.h"
+
+#define CLAMP(x, lo, hi)  ((x) < (lo) ? (lo) : (x) > (hi) ? (hi) : (x))
+
+void pointer_init(Pointer *p)
+{
+	memset(p, 0, sizeof(*p));
+}
+
+// deflection past the deadzone, 0 inside it
+static int32_t deflect(int32_t off)
+{
+	if (abs(off) <= POINTER_DEADZONE) {
+		return 0;
+	}
+	return off > 0 ? off - POINTER_DEADZONE : off + POINTER_DEADZONE;
+}
+
+/*
+ * One sensing frame.  d gets the whole counts to report, true if either
+ * is nonzero.  The center is learnt from the first frames and then tracks
+ * the stick whenever it rests in the deadzone, which absorbs drift with
+ * temperature and battery voltage.
+ */
+bool pointer_step(Pointer *p, const uint16_t raw[2], uint32_t dt, int8_t d[2])
+{
+	int32_t off[2], def[2], mag, v, out;
+	int i;
+
+	d[0] = d[1] = 0;
+	if (p->settled < POINTER_SETTLE) {
+		for (i = 0; i < 2; i++) {
+			p->center[i] += ((int32_t)raw[i] << POINTER_Q) / POINTER_SETTLE;
+		}
+		p->settled++;
+		return false;
+	}
+
+	dt = dt > POINTER_MAX_DT ? POINTER_MAX_DT : dt;
+	for (i = 0; i < 2; i++) {
+		off[i] = raw[i] - (p->center[i] >> POINTER_Q);
+		def[i] = deflect(off[i]);
+	}
+	if (!def[0] && !def[1]) {
+		for (i = 0; i < 2; i++) {
+			p->center[i] += (((int32_t)raw[i] << POINTER_Q) - p->center[i]) >> POINTER_DRIFT;
+			p->rem[i] = 0;
+		}
+		return false;
+	}
+
+	mag = abs(def[0]) + abs(def[1]);
+	for (i = 0; i < 2; i++) {
+		// counts/s << POINTER_Q, then this frame's share of it
+		v = def[i] * POINTER_SPEED * (POINTER_ACCEL_KNEE + mag) / POINTER_ACCEL_KNEE;
+		p->rem[i] += (int64_t)v * dt / 1000000;
+		out = p->rem[i] >> POINTER_Q;
+		out = CLAMP(out, -127, 127);
+		p->rem[i] -= out << POINTER_Q;
+		p->rem[i] = CLAMP(p->rem[i], -(1 << POINTER_Q), 1 << POINTER_Q);
+		d[i] = out;
+	}
+	return d[0] || d[1];
+}
@@ -0,0 +1,25 @@
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+ * Stick deflection to pointer counts.  Speed grows with deflection past
+ * the deadzone and again with its square, and whatever is under a whole
+ * count carries over to the next frame, so slow movements still arrive.
+ * Rates are raw ADC counts of deflection to counts per second, in 1/256.
+ */
+#define POINTER_SETTLE              32	// frames averaged for the initial center
+#define POINTER_DEADZONE            90	// raw counts either side of center
+#define POINTER_DRIFT                6	// center follows 1/64 of a resting stick
+#define POINTER_SPEED               30	// counts/s per raw count, 8.8 fixed point
+#define POINTER_ACCEL_KNEE         400	// deflection that doubles the speed
+#define POINTER_MAX_DT           50000	// us, longer gaps are a stall, not movement
+#define POINTER_Q                    8
+
+typedef struct {
+	int32_t center[2];	// << POINTER_Q
+	int32_t rem[2];		// counts not yet reported, << POINTER_Q
+	uint16_t settled;	// frames into the initial center
+} Pointer;
+
+void pointer_init(Pointer *p);
+bool pointer_step(Pointer *p, const uint16_t raw[2], uint32_t dt, int8_t d[2]);
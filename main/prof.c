@@ -0,0 +1,68 @@
+#include <stdio.h>
+#include <string.h>
+#include "esp_log.h"
+#include "prof.h"
+
+static const char *TAG = "prof";
+
+void hist_init(Hist *h, const char *name, uint32_t width)
+{
+	memset(h, 0, sizeof(*h));
+	h->name = name;
+	h->width = width;
+	h->min = ~0;
+}
+
+void hist_add(Hist *h, uint32_t us)
+{
+	uint32_t i = us / h->width;
+
+	h->count[i < HIST_LEN ? i : HIST_LEN-1]++;
+	h->n++;
+	if (us < h->min) {
+		h->min = us;
+	}
+	if (us > h->max) {
+		h->max = us;
+	}
+}
+
+// the max since the last call, so one spike is reported once
+uint32_t hist_take_max(Hist *h)
+{
+	uint32_t max = h->max;
+
+	h->max = 0;
+	return max;
+}
+
+// upper edge of the bucket holding the given percentile
+uint32_t hist_percentile(const Hist *h, int pct)
+{
+	uint32_t sum = 0, want = ((uint64_t)h->n * pct + 99) / 100;
+	int i;
+
+	for (i = 0; i < HIST_LEN; i++) {
+		if ((sum += h->count[i]) >= want) {
+			break;
+		}
+	}
+	return (i + 1) * h->width;
+}
+
+void hist_log(const Hist *h)
+{
+	char line[HIST_LEN*6+1];
+	int i, n = 0;
+
+	if (h->n == 0) {
+		return;
+	}
+	for (i = 0; i < HIST_LEN && n < sizeof(line); i++) {
+		n += snprintf(&line[n], sizeof(line)-n, " %lu", (unsigned long)h->count[i]);
+	}
+	ESP_LOGI(TAG, "%s: n %lu min %lu p50 <%lu p99 <%lu max %lu us, %lu us buckets:%s",
+		h->name, (unsigned long)h->n, (unsigned long)h->min,
+		(unsigned long)hist_percentile(h, 50), (unsigned long)hist_percentile(h, 99),
+		(unsigned long)h->max, (unsigned long)h->width, line);
+}
@@ -0,0 +1,18 @@
+#include <stdint.h>
+
+#define HIST_LEN                    32
+
+// linear histogram, the last bucket collects everything past the range
+typedef struct Hist {
+	const char *name;
+	uint32_t width;		// bucket width in us
+	uint32_t count[HIST_LEN];
+	uint32_t n;
+	uint32_t min, max;
+} Hist;
+
+void hist_init(Hist *h, const char *name, uint32_t width);
+void hist_add(Hist *h, uint32_t us);
+uint32_t hist_take_max(Hist *h);
+uint32_t hist_percentile(const Hist *h, int pct);
+void hist_log(const Hist *h);
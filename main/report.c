@@ -0,0 +1,243 @@
+#include <string.h>
+#include "prof.h"
+#include "report.h"
+
+/*
+ * Reports wait in queue until the window has room.  Only the sending task
+ * touches the queue; the window is shared with the Bluetooth task, which
+ * retires the oldest notification on every completion event.
+ */
+static Report queue[REPORT_QUEUE];
+static uint32_t qhead, qtail;
+
+static struct {
+	uint32_t input;	// Report.us
+	uint32_t sent;
+} window[REPORT_WINDOW];
+static _Atomic uint32_t issued, completed;
+
+static report_send_t send;
+static Hist latency;
+static uint32_t lost, merged;
+
+/*
+ * While the link is congested nothing is handed to the stack, so changes
+ * pile up in the queue and get folded together by the merge functions.
+ */
+static _Atomic bool congested;
+static report_merge_t merge[REPORT_IDS];
+static Report last[REPORT_IDS];	// last report of each id given to the stack
+
+void report_init(report_send_t fn)
+{
+	send = fn;
+	hist_init(&latency, "report latency", 1000);
+	report_reset();
+}
+
+void report_coalesce(uint8_t id, report_merge_t fn)
+{
+	if (id < REPORT_IDS) {
+		merge[id] = fn;
+	}
+}
+
+void report_congest(bool c)
+{
+	atomic_store(&congested, c);
+}
+
+void report_reset(void)
+{
+	qhead = qtail = 0;
+	memset(last, 0, sizeof(last));
+	atomic_store(&completed, atomic_load(&issued));
+}
+
+static const Report *before(uint32_t at, uint8_t id)
+{
+	while (at-- != qtail) {
+		if (queue[at & (REPORT_QUEUE-1)].id == id) {
+			return &queue[at & (REPORT_QUEUE-1)];
+		}
+	}
+	return &last[id];
+}
+
+/*
+ * Only the newest queued report is a merge candidate, so reports of
+ * different ids never change order.
+ */
+bool report_queue(const Report *r)
+{
+	Report *p;
+
+	if (qhead != qtail && r->id < REPORT_IDS && merge[r->id]) {
+		p = &queue[(qhead-1) & (REPORT_QUEUE-1)];
+		if (p->id == r->id && merge[r->id](before(qhead-1, r->id), p, r)) {
+			merged++;
+			return true;
+		}
+	}
+	if (qhead - qtail >= REPORT_QUEUE) {
+		return false;
+	}
+	queue[qhead++ & (REPORT_QUEUE-1)] = *r;
+	return true;
+}
+
+static bool has(const Report *r, uint8_t key)
+{
+	int i;
+
+	for (i = 2; i < r->len; i++) {
+		if (r->data[i] == key) {
+			return true;
+		}
+	}
+	return false;
+}
+
+/*
+ * pending can be replaced by next only if the host still sees every
+ * transition: nothing pending pressed may vanish unseen, and nothing
+ * pending released may be pressed again by next.
+ */
+bool report_merge_keys(const Report *prev, Report *pending, const Report *next)
+{
+	uint8_t k;
+	int i;
+
+	if ((pending->data[0] & ~prev->data[0] & ~next->data[0]) ||
+	    (prev->data[0] & next->data[0] & ~pending->data[0])) {
+		return false;
+	}
+	for (i = 2; i < pending->len; i++) {
+		k = pending->data[i];
+		if (k && !has(prev, k) && !has(next, k)) {
+			return false;
+		}
+	}
+	for (i = 2; i < prev->len; i++) {
+		k = prev->data[i];
+		if (k && has(next, k) && !has(pending, k)) {
+			return false;
+		}
+	}
+	memcpy(pending->data, next->data, sizeof(pending->data));
+	pending->len = next->len;
+	return true;
+}
+
+/*
+ * For reports that hold state but have no per-key structure: only a
+ * pending report that changes nothing, or a repeat of it, goes away.
+ */
+bool report_merge_same(const Report *prev, Report *pending, const Report *next)
+{
+	if (pending->len == next->len && !memcmp(pending->data, next->data, pending->len)) {
+		return true;
+	}
+	if (memcmp(pending->data, prev->data, pending->len)) {
+		return false;
+	}
+	memcpy(pending->data, next->data, sizeof(pending->data));
+	pending->len = next->len;
+	return true;
+}
+
+// relative axes add up as long as the buttons hold still and nothing overflows
+bool report_merge_mouse(const Report *prev, Report *pending, const Report *next)
+{
+	int i, sum[REPORT_LEN];
+
+	if (pending->data[0] != next->data[0] || pending->len != next->len) {
+		return false;
+	}
+	for (i = 1; i < pending->len; i++) {
+		sum[i] = (int8_t)pending->data[i] + (int8_t)next->data[i];
+		if (sum[i] < -127 || sum[i] > 127) {
+			return false;
+		}
+	}
+	for (i = 1; i < pending->len; i++) {
+		pending->data[i] = sum[i];
+	}
+	return true;
+}
+
+static bool retire(uint32_t c, uint32_t now)
+{
+	if (!atomic_compare_exchange_strong(&completed, &c, c + 1)) {
+		return false;
+	}
+	hist_add(&latency, now - window[c % REPORT_WINDOW].input);
+	return true;
+}
+
+// called by the Bluetooth task when the stack reports a notification sent
+void report_done(uint32_t now)
+{
+	uint32_t c = atomic_load(&completed);
+
+	if (c != atomic_load(&issued)) {
+		retire(c, now);
+	}
+}
+
+// returns 0, or the transport error that left the head report queued
+int report_pump(uint32_t now)
+{
+	uint32_t c, i;
+	Report *r;
+	int ret;
+
+	c = atomic_load(&completed);
+	i = atomic_load(&issued);
+	if (c != i && now - window[c % REPORT_WINDOW].sent > REPORT_TIMEOUT_US && retire(c, now)) {
+		lost++;
+	}
+
+	while (qtail != qhead && !atomic_load(&congested)) {
+		c = atomic_load(&completed);
+		i = atomic_load(&issued);
+		if (i - c >= REPORT_WINDOW) {
+			break;
+		}
+		r = &queue[qtail & (REPORT_QUEUE-1)];
+		if ((ret = send(r)) == REPORT_DROP) {
+			qtail++;
+			continue;
+		} else if (ret) {
+			return ret;
+		}
+		if (r->id < REPORT_IDS) {
+			last[r->id] = *r;
+		}
+		window[i % REPORT_WINDOW].input = r->us;
+		window[i % REPORT_WINDOW].sent = now;
+		atomic_store(&issued, i + 1);
+		qtail++;
+	}
+	return 0;
+}
+
+int report_pending(void)
+{
+	return (qhead - qtail) + (atomic_load(&issued) - atomic_load(&completed));
+}
+
+const Hist *report_latency(void)
+{
+	return &latency;
+}
+
+uint32_t report_lost(void)
+{
+	return lost;
+}
+
+uint32_t report_merged(void)
+{
+	return merged;
+}
@@ -0,0 +1,38 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+
+#define REPORT_QUEUE                32	// power of two
+#define REPORT_WINDOW                4	// notifications handed to the stack at once
+#define REPORT_LEN                   8
+#define REPORT_TIMEOUT_US       200000	// give up waiting for a completion
+#define REPORT_IDS                   8
+#define REPORT_DROP                  1	// send result: the link has no place for this report
+
+typedef struct Report {
+	uint32_t us;	// when the input behind the report was seen
+	uint8_t id;	// HID report id
+	uint8_t len;
+	uint8_t data[REPORT_LEN];
+} Report;
+
+struct Hist;
+
+typedef int (*report_send_t)(const Report *r);
+// may fold next into the unsent pending report; prev is what the host last saw
+typedef bool (*report_merge_t)(const Report *prev, Report *pending, const Report *next);
+
+void report_init(report_send_t send);
+void report_coalesce(uint8_t id, report_merge_t merge);
+void report_congest(bool congested);
+void report_reset(void);
+bool report_queue(const Report *r);
+int report_pump(uint32_t now);
+void report_done(uint32_t now);
+int report_pending(void);
+const struct Hist *report_latency(void);
+uint32_t report_lost(void);
+uint32_t report_merged(void);
+bool report_merge_keys(const Report *prev, Report *pending, const Report *next);
+bool report_merge_mouse(const Report *prev, Report *pending, const Report *next);
+bool report_merge_same(const Report *prev, Report *pending, const Report *next);
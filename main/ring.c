@@ -0,0 +1,44 @@
+#include "ring.h"
+
+// all n events or none, so a press never goes in without its release
+bool ring_push_all(Ring *r, const Event *e, int n)
+{
+	uint32_t head = atomic_load_explicit(&r->head, memory_order_relaxed);
+	uint32_t used = head - atomic_load_explicit(&r->tail, memory_order_acquire);
+	int i;
+
+	if (used + n > RING_LEN) {
+		atomic_fetch_add_explicit(&r->dropped, n, memory_order_relaxed);
+		return false;
+	}
+	if (used + n > r->peak) {
+		r->peak = used + n;
+	}
+	for (i = 0; i < n; i++) {
+		r->ev[(head + i) & (RING_LEN-1)] = e[i];
+	}
+	atomic_store_explicit(&r->head, head + n, memory_order_release);
+	return true;
+}
+
+bool ring_push(Ring *r, const Event *e)
+{
+	return ring_push_all(r, e, 1);
+}
+
+bool ring_pop(Ring *r, Event *e)
+{
+	uint32_t tail = atomic_load_explicit(&r->tail, memory_order_relaxed);
+
+	if (tail == atomic_load_explicit(&r->head, memory_order_acquire)) {
+		return false;
+	}
+	*e = r->ev[tail & (RING_LEN-1)];
+	atomic_store_explicit(&r->tail, tail + 1, memory_order_release);
+	return true;
+}
+
+uint32_t ring_dropped(Ring *r)
+{
+	return atomic_load_explicit(&r->dropped, memory_order_relaxed);
+}
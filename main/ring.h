@@ -0,0 +1,35 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+
+#define RING_LEN                    64	// power of two
+
+enum {
+	EV_PRESS = 1 << 0,
+};
+
+typedef struct Event {
+	uint32_t us;	// low 32 bits of esp_timer_get_time()
+	uint8_t flags;
+	uint8_t ch;	// source channel
+	uint8_t code;	// HID usage, or the argument of act
+	uint8_t act;
+} Event;
+
+/*
+ * Single producer, single consumer.  head is only written by the producer
+ * and tail only by the consumer, so neither side ever waits on the other;
+ * a full ring drops the new event and counts it.
+ */
+typedef struct {
+	_Atomic uint32_t head;
+	_Atomic uint32_t tail;
+	_Atomic uint32_t dropped;
+	uint32_t peak;
+	Event ev[RING_LEN];
+} Ring;
+
+bool ring_push(Ring *r, const Event *e);
+bool ring_push_all(Ring *r, const Event *e, int n);
+bool ring_pop(Ring *r, Event *e);
+uint32_t ring_dropped(Ring *r);
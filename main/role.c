@@ -0,0 +1,162 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include "driver/gpio.h"
+#include "esp_log.h"
+#include "nvs.h"
+#include "role.h"
+
+static const char *TAG = "role";
+
+static const Role roles[ROLE_NB] = {
+	[ROLE_LEFT]  = { "left",  ROLE_LEFT,  24 },
+	[ROLE_RIGHT] = { "right", ROLE_RIGHT,  0 },
+};
+
+static Role role;
+static uint8_t strapped, hosting;	// side by the strap, side holding the host
+static role_forward_t forward;
+static _Atomic int pending = -1;	// record offered to the other half, side | primary << 8
+
+static uint8_t stored(const char *key)
+{
+	nvs_handle_t nvs;
+	uint8_t r = ROLE_STRAP;
+
+	if (nvs_open("lask", NVS_READONLY, &nvs) != ESP_OK) {
+		return ROLE_STRAP;
+	}
+	if (nvs_get_u8(nvs, key, &r) != ESP_OK || r >= ROLE_NB) {
+		r = ROLE_STRAP;
+	}
+	nvs_close(nvs);
+	return r;
+}
+
+static esp_err_t store(const char *key, uint8_t v)
+{
+	nvs_handle_t nvs;
+	esp_err_t ret;
+
+	if ((ret = nvs_open("lask", NVS_READWRITE, &nvs)) != ESP_OK) {
+		return ret;
+	}
+	if (v == ROLE_STRAP) {
+		ret = nvs_erase_key(nvs, key);
+		ret = ret == ESP_ERR_NVS_NOT_FOUND ? ESP_OK : ret;
+	} else {
+		ret = nvs_set_u8(nvs, key, v);
+	}
+	if (ret == ESP_OK) {
+		ret = nvs_commit(nvs);
+	}
+	nvs_close(nvs);
+	return ret;
+}
+
+static uint8_t side_of(uint8_t side)
+{
+	return side == ROLE_STRAP ? strapped : side;
+}
+
+static uint8_t primary_of(uint8_t primary)
+{
+	return primary == ROLE_STRAP ? ROLE_LEFT : primary;
+}
+
+const Role *role_detect(role_forward_t fn)
+{
+	uint8_t side;
+
+	gpio_reset_pin(ROLE_GPIO);
+	gpio_set_direction(ROLE_GPIO, GPIO_MODE_INPUT);
+	gpio_set_pull_mode(ROLE_GPIO, GPIO_PULLUP_ONLY);
+	strapped = gpio_get_level(ROLE_GPIO) ? ROLE_LEFT : ROLE_RIGHT;
+	// the strap is only needed once
+	gpio_reset_pin(ROLE_GPIO);
+
+	side = side_of(stored("role"));
+	hosting = primary_of(stored("primary"));
+	forward = fn;
+	role = roles[side];
+	role.primary = side == hosting;
+	ESP_LOGI(TAG, "%s half, %s", role.name, role.primary ? "primary" : "secondary");
+	return &role;
+}
+
+esp_err_t role_forget(void)
+{
+	esp_err_t ret;
+
+	if ((ret = store("role", ROLE_STRAP)) != ESP_OK ||
+	    (ret = store("primary", ROLE_STRAP)) != ESP_OK) {
+		return ret;
+	}
+	ESP_LOGI(TAG, "records forgotten, following the strap from the next boot");
+	return ESP_OK;
+}
+
+/*
+ * The record body is the side of this half and the side that holds the
+ * host, either ROLE_STRAP to go back to the default.  A record that keeps
+ * this half the primary is stored at once; any other waits on the other
+ * half, and is refused when the split link is down since this half would
+ * then leave the host for nobody.
+ */
+esp_err_t role_store(const uint8_t *blob, size_t len)
+{
+	esp_err_t ret;
+
+	if (len != 2 || blob[0] >= ROLE_NB || blob[1] >= ROLE_NB) {
+		return ESP_ERR_INVALID_ARG;
+	}
+	if (side_of(blob[0]) == primary_of(blob[1]) && primary_of(blob[1]) == hosting) {
+		if ((ret = store("role", blob[0])) == ESP_OK) {
+			ESP_LOGI(TAG, "side %d stored, applies on the next boot", blob[0]);
+		}
+		return ret;
+	}
+	atomic_store(&pending, blob[0] | blob[1] << 8);
+	if (!forward || !forward(side_of(blob[0]), primary_of(blob[1]))) {
+		atomic_store(&pending, -1);
+		return ESP_ERR_INVALID_STATE;
+	}
+	ESP_LOGI(TAG, "record offered to the other half");
+	return ESP_OK;
+}
+
+/*
+ * The other half's record for the keyboard: its own side and the side
+ * that holds the host.  Taken when exactly one of the halves ends up
+ * primary.
+ */
+bool role_offered(uint8_t side, uint8_t primary)
+{
+	if (side == role.side || (primary != side && primary != role.side)) {
+		ESP_LOGW(TAG, "offered %d primary with the other half on %d, refused", primary, side);
+		return false;
+	}
+	if (store("primary", primary) != ESP_OK) {
+		return false;
+	}
+	ESP_LOGI(TAG, "side %d holds the host from the next boot", primary);
+	return true;
+}
+
+void role_answered(bool taken)
+{
+	int p = atomic_exchange(&pending, -1);
+
+	if (p < 0) {
+		return;
+	}
+	if (!taken) {
+		ESP_LOGW(TAG, "the other half refused the record");
+		return;
+	}
+	if (store("role", p & 0xff) != ESP_OK || store("primary", p >> 8) != ESP_OK) {
+		ESP_LOGE(TAG, "record taken by the other half but not stored here");
+		return;
+	}
+	ESP_LOGI(TAG, "record stored on both halves, applies on the next boot");
+}
@@ -0,0 +1,43 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "esp_err.h"
+
+/*
+ * One image serves both halves.  The side comes from the stored role
+ * record when there is one, otherwise from ROLE_GPIO, which is left open
+ * on the left half and tied to ground on the right.  Which side holds the
+ * host connection is stored apart from it, the same on both halves, and
+ * is the left until a record moves it.  Both are read once at boot; a new
+ * record takes effect on the next one.
+ *
+ * Records arrive on the primary only, so one that moves the primary or
+ * gives this half the wrong side is first offered to the other half over
+ * the split link and only stored here once that half has taken it.
+ * role_forget drops both records on this half only, so that it follows
+ * the strap again.
+ */
+#define ROLE_GPIO                   21
+
+enum {
+	ROLE_STRAP,	// side: follow ROLE_GPIO, primary: the left
+	ROLE_LEFT,
+	ROLE_RIGHT,
+	ROLE_NB,
+};
+
+typedef struct {
+	const char *name;
+	uint8_t side;
+	uint8_t base;	// keymap index of this half's first finger position
+	bool primary;	// holds the host connection, the other half sends its taps here
+} Role;
+
+// hands a record to the other half, false when it can't be reached
+typedef bool (*role_forward_t)(uint8_t side, uint8_t primary);
+
+const Role *role_detect(role_forward_t forward);
+esp_err_t role_forget(void);
+esp_err_t role_store(const uint8_t *blob, size_t len);
+bool role_offered(uint8_t side, uint8_t primary);
+void role_answered(bool taken);
@@ -0,0 +1,260 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include "split.h"
+
+void split_init(Split *s, Transport *tx, uint8_t session, split_deliver_t deliver,
+                split_offered_t offered, split_answered_t answered, void *ctx)
+{
+	memset(s, 0, sizeof(*s));
+	s->tx = tx;
+	s->session = session;
+	s->deliver = deliver;
+	s->offered = offered;
+	s->answered = answered;
+	s->ctx = ctx;
+}
+
+static void transmit(Split *s, uint32_t now)
+{
+	uint8_t f[SPLIT_FRAME_MAX];
+	uint16_t seq;
+	int n = 0;
+
+	f[0] = SPLIT_MAGIC;
+	f[1] = SPLIT_DATA;
+	f[2] = s->session;
+	f[3] = s->base;
+	f[4] = s->base >> 8;
+	for (seq = s->base; seq != s->next; seq++, n++) {
+		f[SPLIT_HEADER + 2*n] = s->taps[seq % SPLIT_WINDOW].key;
+		f[SPLIT_HEADER + 2*n + 1] = s->taps[seq % SPLIT_WINDOW].ch;
+	}
+	f[5] = n;
+	s->sent = now;
+	s->frames++;
+	s->tx->send(s->tx, f, SPLIT_HEADER + 2*n);
+}
+
+// false when the window is full and the tap was not taken
+bool split_tap(Split *s, const Tap *t, uint32_t now)
+{
+	if ((uint16_t)(s->next - s->base) >= SPLIT_WINDOW) {
+		return false;
+	}
+	s->taps[s->next % SPLIT_WINDOW] = *t;
+	s->queued[s->next % SPLIT_WINDOW] = now;
+	s->next++;
+	transmit(s, now);
+	return true;
+}
+
+static void offer(Split *s, uint32_t now)
+{
+	uint8_t f[] = { SPLIT_MAGIC, SPLIT_ROLE, s->session, s->offer[0], s->offer[1] };
+
+	s->offer_sent = now;
+	s->tx->send(s->tx, f, sizeof(f));
+}
+
+// replaces an offer still unanswered, which is then never answered
+void split_offer(Split *s, uint8_t side, uint8_t primary, uint32_t now)
+{
+	s->offering = true;
+	s->offer[0] = side;
+	s->offer[1] = primary;
+	s->offer_tries = 0;
+	offer(s, now);
+}
+
+static void offered(Split *s, const uint8_t *f)
+{
+	uint8_t ack[] = { SPLIT_MAGIC, SPLIT_ROLE_ACK, f[2], f[3], f[4], 0 };
+
+	ack[5] = s->offered && s->offered(f[3], f[4], s->ctx);
+	s->tx->send(s->tx, ack, sizeof(ack));
+}
+
+static void answered(Split *s, const uint8_t *f)
+{
+	// answers for an earlier boot or an offer since replaced say nothing
+	if (!s->offering || f[2] != s->session || f[3] != s->offer[0] || f[4] != s->offer[1]) {
+		return;
+	}
+	s->offering = false;
+	if (s->answered) {
+		s->answered(f[5], s->ctx);
+	}
+}
+
+static void acked(Split *s, uint16_t next, uint32_t now)
+{
+	uint32_t rtt;
+
+	// only acks that cover something in flight move the window
+	if ((uint16_t)(next - s->base) > (uint16_t)(s->next - s->base) || next == s->base) {
+		return;
+	}
+	for (; s->base != next; s->base++) {
+		rtt = now - s->queued[s->base % SPLIT_WINDOW];
+		s->rtt_sum += rtt;
+		s->rtt_n++;
+		if (rtt > s->rtt_max) {
+			s->rtt_max = rtt;
+		}
+	}
+	s->tries = 0;
+}
+
+static void received(Split *s, uint8_t session, uint16_t seq, const uint8_t *taps, int n)
+{
+	uint8_t ack[SPLIT_HEADER-1];
+	Tap t;
+	int i;
+
+	if (!s->synced || session != s->peer) {
+		s->synced = true;
+		s->peer = session;
+		s->expect = seq;
+	}
+	for (i = 0; i < n; i++, seq++) {
+		if ((int16_t)(seq - s->expect) < 0) {
+			s->dups++;
+			continue;
+		}
+		// the sender gave these up
+		s->skipped += (uint16_t)(seq - s->expect);
+		t.key = taps[2*i];
+		t.ch = taps[2*i + 1];
+		s->deliver(&t, s->ctx);
+		s->expect = seq + 1;
+	}
+	ack[0] = SPLIT_MAGIC;
+	ack[1] = SPLIT_ACK;
+	ack[2] = session;
+	ack[3] = s->expect;
+	ack[4] = s->expect >> 8;
+	s->tx->send(s->tx, ack, sizeof(ack));
+}
+
+void split_input(Split *s, const uint8_t *f, size_t len, uint32_t now)
+{
+	if (len < SPLIT_HEADER-1 || f[0] != SPLIT_MAGIC) {
+		return;
+	}
+	switch (f[1]) {
+	case SPLIT_DATA:
+		if (len >= SPLIT_HEADER && f[5] <= SPLIT_WINDOW && len >= SPLIT_HEADER + 2u*f[5]) {
+			received(s, f[2], f[3] | f[4] << 8, &f[SPLIT_HEADER], f[5]);
+		}
+		break;
+	case SPLIT_ACK:
+		// an ack for an earlier boot of ours says nothing about these taps
+		if (f[2] == s->session) {
+			acked(s, f[3] | f[4] << 8, now);
+		}
+		break;
+	case SPLIT_ROLE:
+		if (len >= 5) {
+			offered(s, f);
+		}
+		break;
+	case SPLIT_ROLE_ACK:
+		if (len >= 6) {
+			answered(s, f);
+		}
+		break;
+	}
+}
+
+static uint32_t poll_offer(Split *s, uint32_t now)
+{
+	if (!s->offering) {
+		return 0;
+	}
+	if (now - s->offer_sent < SPLIT_RTO_US) {
+		return SPLIT_RTO_US - (now - s->offer_sent);
+	}
+	if (s->offer_tries >= SPLIT_RETRIES) {
+		s->offering = false;
+		if (s->answered) {
+			s->answered(false, s->ctx);
+		}
+		return 0;
+	}
+	s->offer_tries++;
+	offer(s, now);
+	return SPLIT_RTO_US;
+}
+
+static uint32_t poll_taps(Split *s, uint32_t now)
+{
+	if (s->base == s->next) {
+		return 0;
+	}
+	if (now - s->sent < SPLIT_RTO_US) {
+		return SPLIT_RTO_US - (now - s->sent);
+	}
+	if (s->tries >= SPLIT_RETRIES) {
+		s->gaveup++;
+		s->base++;
+		s->tries = 0;
+		if (s->base == s->next) {
+			return 0;
+		}
+	}
+	s->tries++;
+	s->resent++;
+	transmit(s, now);
+	return SPLIT_RTO_US;
+}
+
+/*
+ * Resends when the oldest tap or an offer has waited SPLIT_RTO_US.
+ * Returns how long until it needs calling again, 0 when nothing is in
+ * flight.
+ */
+uint32_t split_poll(Split *s, uint32_t now)
+{
+	uint32_t taps = poll_taps(s, now), role = poll_offer(s, now);
+
+	return !taps ? role : !role ? taps : taps < role ? taps : role;
+}
+
+static int loopback_send(Transport *t, const uint8_t *frame, size_t len)
+{
+	Loopback *l = t->ctx;
+
+	if (l->loss && ++l->n % l->loss == 0) {
+		l->lost++;
+		return 0;
+	}
+	if (l->head - l->tail >= LOOPBACK_QUEUE || len > SPLIT_FRAME_MAX) {
+		l->lost++;
+		return -1;
+	}
+	l->q[l->head % LOOPBACK_QUEUE].at = l->now + l->delay;
+	l->q[l->head % LOOPBACK_QUEUE].len = len;
+	memcpy(l->q[l->head % LOOPBACK_QUEUE].frame, frame, len);
+	l->head++;
+	return 0;
+}
+
+void loopback_init(Loopback *l, Split *to, uint32_t delay, uint32_t loss)
+{
+	memset(l, 0, sizeof(*l));
+	l->tx.send = loopback_send;
+	l->tx.ctx = l;
+	l->to = to;
+	l->delay = delay;
+	l->loss = loss;
+}
+
+void loopback_run(Loopback *l, uint32_t now)
+{
+	l->now = now;
+	while (l->tail != l->head && (int32_t)(now - l->q[l->tail % LOOPBACK_QUEUE].at) >= 0) {
+		split_input(l->to, l->q[l->tail % LOOPBACK_QUEUE].frame, l->q[l->tail % LOOPBACK_QUEUE].len, now);
+		l->tail++;
+	}
+}
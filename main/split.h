@@ -0,0 +1,98 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+ * Taps from the secondary half to the primary, which owns the host
+ * connection and the keymap.  Every data frame carries all taps not yet
+ * acked, so a lost frame costs nothing once the next one gets through and
+ * the receiver sees taps once and in order.  A tap resent SPLIT_RETRIES
+ * times is given up so a dead peer can't hold the window.  The primary
+ * also offers role records the other way, resent the same until answered.
+ */
+#define SPLIT_MAGIC               0x4c
+#define SPLIT_WINDOW                16	// taps in flight
+#define SPLIT_RTO_US             10000	// one FreeRTOS tick
+#define SPLIT_RETRIES                6
+#define SPLIT_HEADER                 6
+#define SPLIT_FRAME_MAX  (SPLIT_HEADER + 2*SPLIT_WINDOW)
+
+enum {
+	SPLIT_DATA,	// magic, type, session, seq (le16), count, taps
+	SPLIT_ACK,	// magic, type, session, next expected seq (le16)
+	SPLIT_ROLE,	// magic, type, session, side, primary
+	SPLIT_ROLE_ACK,	// magic, type, session, side, primary, taken
+};
+
+// a keymap index the other half settled on
+typedef struct {
+	uint8_t key;
+	uint8_t ch;	// finger channel on the sending half
+} Tap;
+
+typedef struct Transport Transport;
+struct Transport {
+	int (*send)(Transport *t, const uint8_t *frame, size_t len);
+	void *ctx;
+};
+
+typedef void (*split_deliver_t)(const Tap *tap, void *ctx);
+// the other half's role record, true once taken
+typedef bool (*split_offered_t)(uint8_t side, uint8_t primary, void *ctx);
+typedef void (*split_answered_t)(bool taken, void *ctx);
+
+typedef struct {
+	Transport *tx;
+	split_deliver_t deliver;
+	split_offered_t offered;
+	split_answered_t answered;
+	void *ctx;
+	uint8_t session;	// picked at boot, a new one resyncs the receiver
+	// sending
+	Tap taps[SPLIT_WINDOW];
+	uint32_t queued[SPLIT_WINDOW];	// when each tap was handed over
+	uint16_t base, next;	// oldest unacked, next to assign
+	uint32_t sent;
+	uint8_t tries;		// resends of base
+	bool offering;
+	uint8_t offer[2];	// side, primary
+	uint8_t offer_tries;
+	uint32_t offer_sent;
+	// receiving
+	bool synced;
+	uint8_t peer;		// the sender's session
+	uint16_t expect;
+	// counters
+	uint32_t frames, resent, gaveup, dups, skipped;
+	uint32_t rtt_max, rtt_sum, rtt_n;	// tap handed over to its ack, us
+} Split;
+
+void split_init(Split *s, Transport *tx, uint8_t session, split_deliver_t deliver,
+                split_offered_t offered, split_answered_t answered, void *ctx);
+bool split_tap(Split *s, const Tap *t, uint32_t now);
+void split_offer(Split *s, uint8_t side, uint8_t primary, uint32_t now);
+void split_input(Split *s, const uint8_t *frame, size_t len, uint32_t now);
+uint32_t split_poll(Split *s, uint32_t now);
+
+/*
+ * In-memory transport with delay and loss, so the protocol runs on Linux.
+ * Frames wait in the loopback until loopback_run delivers them.
+ */
+#define LOOPBACK_QUEUE               8
+
+typedef struct {
+	Transport tx;
+	Split *to;
+	uint32_t delay;		// us
+	uint32_t loss;		// drop every loss-th frame, 0 keeps all
+	uint32_t now, n, lost;
+	uint32_t head, tail;
+	struct {
+		uint32_t at;
+		uint8_t len;
+		uint8_t frame[SPLIT_FRAME_MAX];
+	} q[LOOPBACK_QUEUE];
+} Loopback;
+
+void loopback_init(Loopback *l, Split *to, uint32_t delay, uint32_t loss);
+void loopback_run(Loopback *l, uint32_t now);
@@ -0,0 +1,47 @@
+#include <stdint.h>
+#include <stdatomic.h>
+#include "state.h"
+
+#define WRITTEN    (1u << 31)
+#define US_MASK    ((1u << 24) - 1)
+
+// written flag, leds above the low 24 bits of the write time
+static _Atomic uint32_t hosts[STATE_HOSTS];
+
+void state_leds(int slot, uint8_t leds, uint32_t us)
+{
+	if (slot < 0 || slot >= STATE_HOSTS) {
+		return;
+	}
+	atomic_store_explicit(&hosts[slot], WRITTEN | (uint32_t)(leds & LED_ALL) << 24 | (us & US_MASK),
+		memory_order_release);
+}
+
+HostState state_host(int slot)
+{
+	HostState s = { 0 };
+	uint32_t v;
+
+	if (slot < 0 || slot >= STATE_HOSTS) {
+		return s;
+	}
+	v = atomic_load_explicit(&hosts[slot], memory_order_acquire);
+	s.written = !!(v & WRITTEN);
+	s.leds = (v >> 24) & LED_ALL;
+	s.us = v & US_MASK;
+	return s;
+}
+
+// microseconds since the host wrote, good for up to 16 s
+uint32_t state_age(HostState s, uint32_t now)
+{
+	return (now - s.us) & US_MASK;
+}
+
+// a host that reconnects sends its LEDs again
+void state_forget(int slot)
+{
+	if (slot >= 0 && slot < STATE_HOSTS) {
+		atomic_store_explicit(&hosts[slot], 0, memory_order_release);
+	}
+}
@@ -0,0 +1,31 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+
+#define STATE_HOSTS                  4	// at least HID_MAX_APPS
+
+// keyboard LED output report, usage page 0x08 in bit order
+enum {
+	LED_NUM       = 1 << 0,
+	LED_CAPS      = 1 << 1,
+	LED_SCROLL    = 1 << 2,
+	LED_COMPOSE   = 1 << 3,
+	LED_KANA      = 1 << 4,
+	LED_ALL       = (1 << 5) - 1,
+};
+
+typedef struct {
+	bool written;	// the host sent its LEDs since it connected
+	uint8_t leds;
+	uint32_t us;	// low 24 bits of when the write reached the stack
+} HostState;
+
+/*
+ * What each host has told us about itself.  One word per slot, so the
+ * sensing loop and display read it without locking while the app task
+ * writes.
+ */
+void state_leds(int slot, uint8_t leds, uint32_t us);
+HostState state_host(int slot);
+uint32_t state_age(HostState s, uint32_t now);
+void state_forget(int slot);
@@ -0,0 +1,127 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "tinyusb.h"
+#include "class/hid/hid_device.h"
+#include "hid.h"
+#include "output.h"
+#include "report.h"
+#include "state.h"
+#include "usage.h"
+#include "usb.h"
+
+static const char *TAG = "usb";
+
+static uint8_t config[TUD_CONFIG_DESC_LEN + TUD_HID_DESC_LEN];
+static usb_wake_t wake;
+static volatile uint8_t resolution;
+
+static bool ready(void)
+{
+	return tud_mounted();
+}
+
+static int send(const Report *r)
+{
+	if (!tud_hid_ready() || !tud_hid_report(r->id, r->data, r->len)) {
+		return ESP_ERR_NOT_FINISHED;
+	}
+	// the endpoint holds one report, the rest wait and merge until it is polled
+	report_congest(true);
+	return 0;
+}
+
+static uint8_t res(void)
+{
+	return resolution;
+}
+
+static uint32_t interval(void)
+{
+	return USB_POLL_MS*1000;
+}
+
+static void activity(void)
+{
+	if (tud_suspended()) {
+		tud_remote_wakeup();
+	}
+}
+
+const Output usb_output = { "usb", ready, send, res, interval, activity };
+
+uint8_t const *tud_hid_descriptor_report_cb(uint8_t instance)
+{
+	uint16_t len;
+
+	return hid_report_map(&len);
+}
+
+void tud_hid_report_complete_cb(uint8_t instance, uint8_t const *report, uint16_t len)
+{
+	report_done(esp_timer_get_time());
+	report_congest(false);
+	wake();
+}
+
+uint16_t tud_hid_get_report_cb(uint8_t instance, uint8_t id, hid_report_type_t type, uint8_t *buf, uint16_t len)
+{
+	if (type == HID_REPORT_TYPE_FEATURE && id == HID_RPT_ID_MOUSE_IN && len >= 1) {
+		buf[0] = resolution;
+		return 1;
+	}
+	return 0;
+}
+
+// TinyUSB has already taken the report id off the front
+void tud_hid_set_report_cb(uint8_t instance, uint8_t id, hid_report_type_t type, uint8_t const *buf, uint16_t len)
+{
+	if (len < 1) {
+		return;
+	}
+	if (type == HID_REPORT_TYPE_OUTPUT && id == HID_RPT_ID_LED_OUT) {
+		state_leds(USB_SLOT, buf[0], esp_timer_get_time());
+	} else if (type == HID_REPORT_TYPE_FEATURE && id == HID_RPT_ID_MOUSE_IN) {
+		resolution = buf[0];
+		ESP_LOGI(TAG, "wheel %s, pan %s",
+			resolution & HID_RES_WHEEL ? "high resolution" : "detents",
+			resolution & HID_RES_PAN ? "high resolution" : "detents");
+	}
+}
+
+void tud_mount_cb(void)
+{
+	ESP_LOGI(TAG, "mounted");
+	wake();
+}
+
+void tud_umount_cb(void)
+{
+	ESP_LOGI(TAG, "unmounted");
+	resolution = 0;
+	state_forget(USB_SLOT);
+	report_congest(false);
+	wake();
+}
+
+esp_err_t usb_init(usb_wake_t fn)
+{
+	uint16_t len;
+	// default device and string descriptors from menuconfig
+	const tinyusb_config_t cfg = {
+		.external_phy = false,
+		.configuration_descriptor = config,
+	};
+
+	hid_report_map(&len);
+	const uint8_t desc[] = {
+		TUD_CONFIG_DESCRIPTOR(1, 1, 0, sizeof(config), TUSB_DESC_CONFIG_ATT_REMOTE_WAKEUP, 100),
+		TUD_HID_DESCRIPTOR(0, 0, HID_ITF_PROTOCOL_NONE, len, 0x81, CFG_TUD_HID_EP_BUFSIZE, USB_POLL_MS),
+	};
+	_Static_assert(sizeof(desc) == sizeof(config), "configuration descriptor length");
+	memcpy(config, desc, sizeof(config));
+	wake = fn;
+	return tinyusb_driver_install(&cfg);
+}
@@ -0,0 +1,20 @@
+#include <stdint.h>
+#include "esp_err.h"
+
+/*
+ * The report map over the S3's own USB port, polled every USB_POLL_MS.
+ * Completions retire the report window like Bluetooth notifications do,
+ * and one report is held by the endpoint at a time.  The port's PHY moves
+ * from USB-Serial-JTAG to TinyUSB, so the console is on UART0 only and
+ * flashing over USB needs the ROM downloader: hold boot through reset.
+ */
+#define USB_POLL_MS                  1
+#define USB_SLOT                     3	// host state slot, past the Bluetooth hosts
+
+struct Output;
+
+// mounted, gone, or a report went out; runs on the TinyUSB task
+typedef void (*usb_wake_t)(void);
+
+esp_err_t usb_init(usb_wake_t wake);
+extern const struct Output usb_output;